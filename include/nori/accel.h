@@ -19,31 +19,53 @@
 #pragma once
 
 #include <nori/mesh.h>
+#include <nori/trianglepack.h>
 
 NORI_NAMESPACE_BEGIN
 
 /**
  * \brief Acceleration data structure for ray intersection queries
  *
- * The current implementation falls back to a brute force loop
- * through the geometry.
+ * This is a bounding volume hierarchy over all shapes of the scene, which
+ * can be used instead of Embree (see the \c accel property of \ref Scene).
+ * Meshes contribute their triangles and sphere sets their spheres as
+ * individual primitives, all other shapes are a single primitive each.
+ *
+ * The hierarchy is built top-down in parallel with the surface area
+ * heuristic, which is evaluated for a fixed number of bins along every
+ * axis. The nodes are then flattened in depth-first order, so that the
+ * first child of a node directly follows it in memory, and the primitives
+ * of every leaf are stored contiguously.
+ *
+ * Every leaf holds up to \ref NORI_TRIANGLE_PACK primitives. The triangles
+ * of a leaf come first and are also stored in a \ref TrianglePack, so that
+ * they are tested against a ray at once.
  */
 class Accel {
 public:
     /**
-     * \brief Register a triangle mesh for inclusion in the acceleration
+     * \brief Register a shape for inclusion in the acceleration
      * data structure
      *
      * This function can only be used before \ref build() is called
      */
-    void addMesh(Mesh *mesh);
+    void addShape(Shape *shape);
 
-    /// Build the acceleration data structure (currently a no-op)
+    /// Build the acceleration data structure
     void build();
 
-    /// Return an axis-aligned box that bounds the scene
+    /// Release the hierarchy (the registered shapes are kept)
+    void clear();
+
+    /// Return an axis-aligned box that bounds the scene (once it has been built)
     const BoundingBox3f &getBoundingBox() const { return m_bbox; }
 
+    /// Return the memory used by the hierarchy (in bytes)
+    size_t getMemoryUsage() const {
+        return m_nodes.size() * sizeof(Node) + m_primitives.size() * sizeof(Primitive) +
+               m_packs.size() * sizeof(TrianglePack);
+    }
+
     /**
      * \brief Intersect a ray against all triangles stored in the scene and
      * return detailed intersection information
@@ -66,8 +88,43 @@ public:
     bool rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const;
 
 private:
-    Mesh         *m_mesh = nullptr; ///< Mesh (only a single one for now)
-    BoundingBox3f m_bbox;           ///< Bounding box of the entire scene
+    /// A triangle, a sphere of a sphere set or an entire shape
+    struct Primitive {
+        uint32_t shape; ///< Index into \c m_shapes
+        uint32_t index; ///< Index of the triangle or sphere
+    };
+
+    /// Node of the flattened hierarchy (two of them share a cache line)
+    struct Node {
+        BoundingBox3f bbox;
+        /// Leaf: first primitive, inner node: index of the second child
+        uint32_t offset;
+        uint16_t count;  ///< Number of primitives (0 for inner nodes)
+        union {
+            uint16_t axis;      ///< Split axis (inner nodes)
+            uint16_t triangles; ///< Number of triangles at the start of a leaf
+        };
+    };
+
+    struct ShapeEntry {
+        const Shape *shape;
+        const Mesh *mesh;         ///< \c shape if it is a mesh
+        const SphereSet *spheres; ///< \c shape if it is a sphere set
+    };
+
+    struct BuildNode;
+    struct BuildContext;
+
+    BuildNode *buildRecursive(BuildContext &ctx, uint32_t start, uint32_t end, int depth) const;
+    uint32_t flatten(const BuildNode *node);
+    void buildPacks();
+    bool intersectPrimitive(const Primitive &prim, const Ray3f &ray, float &t, RTCHit &hit) const;
+
+    std::vector<ShapeEntry> m_shapes;
+    std::vector<Primitive> m_primitives; ///< Primitives of every leaf, padded to a full pack
+    std::vector<TrianglePack> m_packs;   ///< Triangles of every leaf (empty without meshes)
+    std::vector<Node> m_nodes;           ///< Nodes in depth-first order
+    BoundingBox3f m_bbox;                ///< Bounding box of the entire scene
 };
 
 NORI_NAMESPACE_END
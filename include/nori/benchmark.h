@@ -0,0 +1,50 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Run one of the built-in performance benchmarks
+ *
+ * Benchmarks are started using <tt>nori --benchmark name [args]</tt>
+ * and print a table with their measurements on the console.
+ *
+ * \param name
+ *     Name of the benchmark (or "list" to print the available ones)
+ * \param args
+ *     Remaining command line arguments
+ * \return
+ *     Exit code of the program
+ */
+extern int runBenchmark(const std::string &name, const std::vector<std::string> &args);
+
+/**
+ * \brief Return the thread counts that benchmarks sweep over
+ * (1, 2, 4, .., maxThreads)
+ *
+ * \param maxThreads
+ *     Largest thread count (0: all cores). The sweep never exceeds the
+ *     thread limit that is currently active.
+ */
+extern std::vector<int> benchmarkThreadCounts(int maxThreads = 0);
+
+NORI_NAMESPACE_END
@@ -20,6 +20,7 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <map>
 
 NORI_NAMESPACE_BEGIN
 
@@ -46,6 +47,16 @@ public:
 
     /// Save the bitmap as an EXR file with the specified filename
     void save(const std::string &filename);
+
+    /// Attach a string attribute that is stored in the header of saved files
+    void setMetadata(const std::string &name, const std::string &value) {
+        m_metadata[name] = value;
+    }
+
+    /// Return the attributes stored in the file header
+    const std::map<std::string, std::string> &getMetadata() const { return m_metadata; }
+private:
+    std::map<std::string, std::string> m_metadata;
 };
 
 NORI_NAMESPACE_END
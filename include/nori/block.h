@@ -25,11 +25,55 @@
 #include <nori/color.h>
 #include <nori/vector.h>
 #include <tbb/mutex.h>
+#include <tbb/cache_aligned_allocator.h>
+#include <limits>
+#include <map>
+#include <atomic>
 
-#define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
+#define NORI_BLOCK_SIZE 32 /* Default block size used for parallelization */
+#define NORI_BAND_SIZE  8  /* Number of rows protected by one lock */
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Running statistics of the samples that were taken within a pixel
+ *
+ * These are used to estimate the remaining noise of a pixel during
+ * adaptive rendering. Only the luminance of the samples is tracked.
+ */
+struct PixelStatistics {
+    double sum = 0.0;    ///< Sum of the sample luminances
+    double sumSq = 0.0;  ///< Sum of the squared sample luminances
+    uint32_t count = 0;  ///< Number of samples
+
+    /// Record a sample
+    void put(float luminance) {
+        sum += luminance;
+        sumSq += (double) luminance * luminance;
+        ++count;
+    }
+
+    /// Merge the statistics of another set of samples
+    PixelStatistics &operator+=(const PixelStatistics &s) {
+        sum += s.sum;
+        sumSq += s.sumSq;
+        count += s.count;
+        return *this;
+    }
+
+    /**
+     * \brief Return the standard error of the pixel mean relative
+     * to the mean itself (infinity if fewer than two samples were taken)
+     */
+    float relativeError() const {
+        if (count < 2)
+            return std::numeric_limits<float>::infinity();
+        double mean = sum / count;
+        double variance = std::max(0.0, (sumSq - sum * mean) / (count - 1));
+        return (float) (std::sqrt(variance / count) / std::max(mean, 1e-3));
+    }
+};
+
 /**
  * \brief Weighted pixel storage for a rectangular subregion of an image
  *
@@ -43,6 +87,11 @@ NORI_NAMESPACE_BEGIN
  * this region. For that reason, this class also stores information about
  * a small border region around the rectangle, whose size depends on the
  * properties of the reconstruction filter.
+ *
+ * Merging blocks into a shared image is synchronized using one mutex per
+ * band of \ref NORI_BAND_SIZE rows, so that threads which finish blocks
+ * in different parts of the image (or in different rows of the same
+ * blocks) don't have to wait for each other.
  */
 class ImageBlock : public Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> {
 public:
@@ -85,8 +134,52 @@ public:
     /// Convert a bitmap into an image block
     void fromBitmap(const Bitmap &bitmap);
 
+    /**
+     * \brief Save the unnormalized contents as an OpenEXR file
+     *
+     * The file has the channels R, G, B (the weighted sums of the
+     * samples) and W (the sum of the filter weights) and excludes the
+     * border region. Several such images of the same scene can be summed
+     * and then normalized, e.g. using the <tt>nori-merge</tt> tool.
+     *
+     * \param metadata
+     *     String attributes that are stored in the file header
+     */
+    void saveWeighted(const std::string &filename,
+                      const std::map<std::string, std::string> &metadata) const;
+
     /// Clear all contents
-    void clear() { setConstant(Color4f()); }
+    void clear();
+
+    /**
+     * \brief Additionally keep track of per-pixel sample statistics
+     *
+     * This is needed to estimate the remaining noise of each
+     * pixel when rendering adaptively (see \ref PixelStatistics)
+     */
+    void enableStatistics();
+
+    /// Are per-pixel sample statistics being recorded?
+    bool hasStatistics() const { return !m_stats.empty(); }
+
+    /// Return the sample statistics of a pixel (relative to the block offset)
+    const PixelStatistics &getStatistics(int x, int y) const {
+        return m_stats[y * m_statsStride + x];
+    }
+
+    /**
+     * \brief Write the unnormalized contents (including the border
+     * region and the sample statistics) to a binary stream
+     */
+    void write(std::ostream &os) const;
+
+    /**
+     * \brief Read contents that were written by \ref write()
+     *
+     * The stream must have been written by a block of the same
+     * dimensions and configuration, otherwise an exception is thrown.
+     */
+    void read(std::istream &is);
 
     /// Record a sample with the given position and radiance value
     void put(const Point2f &pos, const Color3f &value);
@@ -94,16 +187,25 @@ public:
     /**
      * \brief Merge another image block into this one
      *
-     * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * The rows are merged one band at a time, and only the
+     * mutex of the band being merged is held.
      */
     void put(ImageBlock &b);
 
-    /// Lock the image block (using an internal mutex)
-    inline void lock() const { m_mutex.lock(); }
-    
-    /// Unlock the image block
-    inline void unlock() const { m_mutex.unlock(); }
+    /// Lock the entire image block (i.e. all bands in order)
+    void lock() const;
+
+    /// Unlock the entire image block
+    void unlock() const;
+
+    /// Return the number of row bands (including the border region)
+    inline int getBandCount() const { return (int) m_bands.size(); }
+
+    /// Lock a single band of rows
+    inline void lockBand(int band) const { m_bands[band].mutex.lock(); }
+
+    /// Unlock a single band of rows
+    inline void unlockBand(int band) const { m_bands[band].mutex.unlock(); }
 
     /// Return a human-readable string summary
     std::string toString() const;
@@ -116,16 +218,51 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
-    mutable tbb::mutex m_mutex;
+    std::vector<PixelStatistics> m_stats;
+    int m_statsStride = 0;
+
+    /// Band mutex padded to a cache line to prevent false sharing
+    struct Band {
+        tbb::mutex mutex;
+        char padding[64];
+    };
+    mutable std::vector<Band, tbb::cache_aligned_allocator<Band>> m_bands;
+};
+
+/**
+ * \brief Orders in which the cells of a 2D grid can be traversed
+ *
+ * These are used both for the blocks of an image and for the
+ * pixels within a block. The Morton (Z-order) and Hilbert curves
+ * keep consecutive cells close to each other, which improves the
+ * coherence of consecutive camera rays.
+ */
+enum ETraversalOrder {
+    EScanlineOrder = 0, ///< Row by row
+    ESpiralOrder,       ///< Spiral around the center
+    EMortonOrder,       ///< Morton (Z-order) curve
+    EHilbertOrder       ///< Hilbert curve
 };
 
+/// Look up a traversal order by name ("scanline", "spiral", "morton" or "hilbert")
+extern ETraversalOrder toTraversalOrder(const std::string &name);
+
+/// Return the name of a traversal order
+extern std::string toString(ETraversalOrder order);
+
+/// Return all cells of a grid of the given size in the specified order
+extern std::vector<Point2i> traverseGrid(const Vector2i &size, ETraversalOrder order);
+
 /**
- * \brief Spiraling block generator
+ * \brief Block generator
  *
  * This class can be used to chop up an image into many small
- * rectangular blocks suitable for parallel rendering. The blocks
- * are ordered in spiraling pattern so that the center is
+ * rectangular blocks suitable for parallel rendering. By default,
+ * the blocks are ordered in spiraling pattern so that the center is
  * rendered first.
+ *
+ * The sequence of blocks is computed once, and blocks are handed
+ * out using an atomic counter, so that no locking is needed.
  */
 class BlockGenerator {
 public:
@@ -135,8 +272,14 @@ public:
      *      Size of the image that should be split into blocks
      * \param blockSize
      *      Maximum size of the individual blocks
+     * \param order
+     *      Order in which the blocks are handed out
+     * \param offset
+     *      Upper left corner of the region (e.g. a crop window)
      */
-    BlockGenerator(const Vector2i &size, int blockSize);
+    BlockGenerator(const Vector2i &size, int blockSize,
+                   ETraversalOrder order = ESpiralOrder,
+                   const Point2i &offset = Point2i(0, 0));
     
     /**
      * \brief Return the next block to be rendered
@@ -147,20 +290,27 @@ public:
      */
     bool next(ImageBlock &block);
 
+    /// Return the offset and size of the next block to be rendered (thread-safe)
+    bool next(Point2i &offset, Vector2i &size);
+
+    /// Have all blocks been handed out?
+    bool isEmpty() const { return m_next >= (int) m_blocks.size(); }
+
+    /**
+     * \brief Start over with the first block (e.g. for the next rendering pass)
+     *
+     * This must not be called while other threads request blocks
+     */
+    void reset() { m_next = 0; }
+
     /// Return the total number of blocks
-    int getBlockCount() const { return m_blocksLeft; }
+    int getBlockCount() const { return (int) m_blocks.size(); }
 protected:
-    enum EDirection { ERight = 0, EDown, ELeft, EUp };
-
-    Point2i m_block;
-    Vector2i m_numBlocks;
+    Point2i m_offset;
     Vector2i m_size;
     int m_blockSize;
-    int m_numSteps;
-    int m_blocksLeft;
-    int m_stepsLeft;
-    int m_direction;
-    tbb::mutex m_mutex;
+    std::vector<Point2i> m_blocks;
+    std::atomic<int> m_next{0};
 };
 
 NORI_NAMESPACE_END
@@ -60,6 +60,30 @@ public:
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
+    /**
+     * \brief Restrict rendering to a rectangular part of the image
+     *
+     * \param offset
+     *    Upper left corner of the crop window in pixels
+     * \param size
+     *    Size of the crop window in pixels. The window must
+     *    lie within the output image.
+     */
+    void setCropWindow(const Point2i &offset, const Vector2i &size) {
+        if ((offset.array() < 0).any() || (size.array() <= 0).any() ||
+            ((offset + size).array() > m_outputSize.array()).any())
+            throw NoriException("Camera: the crop window %s+%s lies outside of the %s image!",
+                size.toString(), offset.toString(), m_outputSize.toString());
+        m_cropOffset = offset;
+        m_cropSize = size;
+    }
+
+    /// Return the upper left corner of the crop window
+    const Point2i &getCropOffset() const { return m_cropOffset; }
+
+    /// Return the size of the crop window (the output size if there is none)
+    const Vector2i &getCropSize() const { return m_cropSize; }
+
     /// Return the camera's reconstruction filter in image space
     const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter; }
 
@@ -70,6 +94,8 @@ public:
     EClassType getClassType() const { return ECamera; }
 protected:
     Vector2i m_outputSize;
+    Point2i m_cropOffset;
+    Vector2i m_cropSize;
     ReconstructionFilter *m_rfilter;
 };
 
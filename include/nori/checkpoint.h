@@ -0,0 +1,95 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+NORI_NAMESPACE_BEGIN
+
+/// Progress information that is stored along with a checkpoint
+struct CheckpointInfo {
+    uint32_t passes = 0;           ///< Number of completed progressive passes
+    uint32_t samples = 0;          ///< Samples per pixel taken in these passes
+    uint32_t passSampleCount = 0;  ///< Samples per pixel of a single pass
+    double elapsed = 0;            ///< Render time so far (in milliseconds)
+    uint32_t seed = 0;             ///< Seed of the sample sequences (see \ref RenderOptions::seed)
+};
+
+/**
+ * \brief Writes checkpoints of an in-progress rendering in the background
+ *
+ * A checkpoint contains the unnormalized image including the filter
+ * weights (and the sample statistics of adaptive rendering) after
+ * a completed pass. It is first written to a temporary file, which
+ * then replaces the previous checkpoint, so that an interrupted
+ * process never leaves a corrupted checkpoint behind.
+ */
+class CheckpointWriter {
+public:
+    /**
+     * \param filename
+     *     Filename of the checkpoint
+     * \param sceneHash
+     *     Hash of the scene description (see \ref hashFile()), used
+     *     to reject checkpoints of other scenes when resuming
+     */
+    CheckpointWriter(const std::string &filename, uint64_t sceneHash);
+
+    /// Wait for the pending checkpoint to be written
+    ~CheckpointWriter();
+
+    /**
+     * \brief Take a snapshot of the image and write it asynchronously
+     *
+     * The image is copied before the function returns. If the previous
+     * snapshot hasn't been written yet, it is replaced by the new one.
+     */
+    void write(const ImageBlock &image, const CheckpointInfo &info);
+
+    /// Wait until the pending checkpoint has been written
+    void flush();
+
+private:
+    void run();
+
+    std::string m_filename;
+    uint64_t m_sceneHash;
+    std::string m_pending;
+    bool m_hasPending = false;
+    bool m_busy = false;
+    bool m_stop = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+/**
+ * \brief Load a checkpoint written by \ref CheckpointWriter
+ *
+ * \return \c false if the file does not exist. An exception is thrown
+ *     if it belongs to a different scene or image configuration, or if
+ *     it covers a different region (crop window) than \c image.
+ */
+extern bool loadCheckpoint(const std::string &filename, uint64_t sceneHash,
+                           ImageBlock &image, CheckpointInfo &info);
+
+NORI_NAMESPACE_END
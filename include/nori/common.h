@@ -122,7 +122,9 @@ class Bitmap;
 class BlockGenerator;
 class Camera;
 class ImageBlock;
+class Instance;
 class Integrator;
+struct Intersection;
 class KDTree;
 class Emitter;
 struct EmitterSamplingResult;
@@ -134,6 +136,10 @@ class PhaseFunction;
 class ReconstructionFilter;
 class Sampler;
 class Scene;
+class ShapeGroup;
+class SphereSet;
+class ShadowQueue;
+class Wavefront;
 
 /// Import cout, cerr, endl for debugging purposes
 using std::cout;
@@ -154,6 +160,9 @@ public:
 /// Return the number of cores (real and virtual)
 extern int getCoreCount();
 
+/// Return the number of threads used for rendering (limited by \c --threads)
+extern int getThreadCount();
+
 /// Indent a string by the specified number of spaces
 extern std::string indent(const std::string &string, int amount = 2);
 
@@ -187,6 +196,9 @@ extern std::string timeString(double time, bool precise = false);
 /// Convert a memory amount in bytes into a human-readable string
 extern std::string memString(size_t size, bool precise = false);
 
+/// Compute a 64 bit hash of the contents of a file (FNV-1a)
+extern uint64_t hashFile(const std::string &filename);
+
 /// Measures associated with probability distributions
 enum EMeasure {
     EUnknownMeasure = 0,
@@ -1,12 +1,20 @@
 #pragma once
 
 #include <nori/common.h>
+#include <nori/stats.h>
 #include <embree3/rtcore_device.h>
+#include <tbb/task_arena.h>
 
 NORI_NAMESPACE_BEGIN
 
 /**
 @brief Singleton that holds the Embree device
+
+The device is created when it is first used, with the configuration
+of the scene ("embreeConfig" property) followed by the one given on the
+command line, so that the latter takes precedence. Errors are printed
+and counted, and the memory that Embree allocates is tracked by the
+global \ref Statistics.
 */
 class EmbreeDevice {
 
@@ -20,17 +28,119 @@ public:
 	EmbreeDevice& operator=(const EmbreeDevice&) = delete;
 
 	~EmbreeDevice() {
-		rtcReleaseDevice(m_device);
+		if (m_device)
+			rtcReleaseDevice(m_device);
 	}
 
+	/// Return the device (\c nullptr if Embree isn't supported on this machine)
 	RTCDevice device() const { return m_device; }
 
+	/// Return the configuration string the device was created with
+	const std::string& config() const { return m_config; }
+
+	/// Return the memory that is currently allocated by Embree (in bytes)
+	size_t memoryUsage() const {
+		return (size_t)std::max<int64_t>(0, Statistics::instance().embreeMemory.value());
+	}
+
+	/**
+	@brief Set the configuration string given on the command line (e.g.
+	"threads=4,isa=avx2,verbose=1")
+
+	This must happen before the device is first used.
+	*/
+	static void setConfig(const std::string& config) {
+		settings().cliConfig = config;
+	}
+
+	/**
+	@brief Set the configuration string of the scene, which is overridden
+	by the command line
+
+	Once the device exists, it can't be reconfigured: a different
+	configuration is ignored with a warning.
+	*/
+	static void setSceneConfig(const std::string& config) {
+		Settings& s = settings();
+		if (s.created && config != s.sceneConfig) {
+			cerr << "Warning: the Embree device already exists, ignoring embreeConfig = \""
+			     << config << "\"" << endl;
+			return;
+		}
+		s.sceneConfig = config;
+	}
+
+	/**
+	@brief Return the task arena in which Embree builds its BVHs
+
+	Embree's TBB tasks run in the arena of the thread that commits a
+	scene. Since the renderer works in the same arena (except for the
+	per-node arenas of NUMA mode), building and rendering never compete
+	for cores, and a thread limit applies to both.
+	*/
+	static tbb::task_arena& arena() {
+		static tbb::task_arena _arena;
+		return _arena;
+	}
+
 private:
+	struct Settings {
+		std::string sceneConfig;
+		std::string cliConfig;
+		bool created = false;
+	};
+
+	static Settings& settings() {
+		static Settings _settings;
+		return _settings;
+	}
+
+	static const char* errorString(RTCError code) {
+		switch (code) {
+			case RTC_ERROR_NONE: return "none";
+			case RTC_ERROR_INVALID_ARGUMENT: return "invalid argument";
+			case RTC_ERROR_INVALID_OPERATION: return "invalid operation";
+			case RTC_ERROR_OUT_OF_MEMORY: return "out of memory";
+			case RTC_ERROR_UNSUPPORTED_CPU: return "unsupported CPU";
+			case RTC_ERROR_CANCELLED: return "cancelled";
+			default: return "unknown error";
+		}
+	}
+
 	EmbreeDevice() {
-		m_device = rtcNewDevice(nullptr);
+		// the statistics are used by the callbacks up to rtcReleaseDevice(), so they
+		// must be constructed first to be destroyed after the device at exit
+		Statistics::instance();
+
+		Settings& s = settings();
+		s.created = true;
+		m_config = s.sceneConfig;
+		if (!s.cliConfig.empty())
+			m_config += (m_config.empty() ? "" : ",") + s.cliConfig;
+
+		m_device = rtcNewDevice(m_config.empty() ? nullptr : m_config.c_str());
+		if (!m_device) {
+			cerr << "Embree error: could not create the device with config \"" << m_config
+			     << "\" (" << errorString(rtcGetDeviceError(nullptr)) << ")" << endl;
+			return;
+		}
+		rtcSetDeviceErrorFunction(m_device,
+		                          [](void*, RTCError code, const char* str) {
+			                          Statistics::instance().embreeErrors.add();
+			                          cerr << "Embree error (" << errorString(code) << ")"
+			                               << (str ? std::string(": ") + str : std::string()) << endl;
+		                          },
+		                          nullptr);
+		rtcSetDeviceMemoryMonitorFunction(m_device,
+		                                  [](void*, ssize_t bytes, bool post) {
+			                                  Statistics::instance().embreeMemory.add(bytes);
+			                                  return true;
+		                                  },
+		                                  nullptr);
 	}
 
 	RTCDevice m_device;
+	std::string m_config;
 };
 
-NORI_NAMESPACE_END
\ No newline at end of file
+NORI_NAMESPACE_END
@@ -0,0 +1,56 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/render.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Render a scene using worker processes on other cores or machines
+ *
+ * The coordinator splits the image into blocks (one task per block and
+ * progressive pass) and hands them out to the workers that connect to
+ * the given address. The workers send back the unnormalized block
+ * contents, which are merged into the final image. When a worker
+ * disconnects, its unfinished tasks are handed to the other workers.
+ *
+ * \param scene
+ *     The scene to be rendered. The workers must load the same file.
+ * \param filename
+ *     Filename of the scene description (see \ref render())
+ * \param address
+ *     Either <tt>unix:/path/to/socket</tt> or <tt>[host:]port</tt>
+ * \param options
+ *     Additional rendering options
+ */
+extern void renderCoordinator(Scene *scene, const std::string &filename,
+                              const std::string &address, const RenderOptions &options);
+
+/**
+ * \brief Render blocks on behalf of a coordinator process
+ *
+ * The worker connects to the given address (see \ref renderCoordinator())
+ * and renders the tasks it receives using all cores of the machine until
+ * the coordinator reports that the image is complete.
+ */
+extern void renderWorker(Scene *scene, const std::string &filename,
+                         const std::string &address);
+
+NORI_NAMESPACE_END
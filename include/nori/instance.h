@@ -0,0 +1,92 @@
+#pragma once
+
+#include <nori/shape.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+@brief A group of shapes that is defined once and placed many times
+by instances (see Instance)
+
+The group itself isn't rendered. Its shapes are built into a separate
+Embree scene, which is shared by all of its instances, so that memory
+usage and build time only depend on the unique geometry. The shapes of
+a group can't be emitters.
+*/
+class ShapeGroup : public Shape {
+
+public:
+	ShapeGroup(const PropertyList& props);
+
+	virtual ~ShapeGroup();
+
+	/// Return the name by which instances refer to the group
+	const std::string& getId() const { return m_id; }
+
+	/// Return the shapes of the group (in its local coordinates)
+	const std::vector<Shape*>& getShapes() const { return m_shapes; }
+
+	float area() const override;
+
+	void addChild(const std::string& name, NoriObject* child) override;
+
+	void activate() override;
+
+	/// Wait for the shapes of the group and compute its bounding box
+	void waitUntilLoaded() override;
+
+	ShapeSamplingResult sample(const Point2f& sample) const override;
+
+	ShapeSamplingResult sample(const Intersection& ref,
+	                           const Point2f& sample) const override;
+
+	std::string toString() const override;
+
+private:
+	std::string m_id;
+	std::vector<Shape*> m_shapes;
+};
+
+/**
+@brief A copy of a ShapeGroup that is placed in the scene with
+its own transform (the 'toWorld' property)
+
+Instances are mapped onto Embree instance geometry. Intersections
+with an instance refer to the shape of the group and carry the
+transform of the instance (see Intersection::instance).
+*/
+class Instance : public Shape {
+
+public:
+	Instance(const PropertyList& props);
+
+	/// Return the name of the instanced group
+	const std::string& getGroupId() const { return m_groupId; }
+
+	/// Return the instanced group (set by the scene)
+	const ShapeGroup* getGroup() const { return m_group; }
+
+	/// Set the instanced group and compute the bounding box of the instance
+	void setGroup(const ShapeGroup* group);
+
+	/// Return the transform from world space into the space of the group
+	const Transform& getToLocal() const { return m_toLocal; }
+
+	float area() const override;
+
+	void activate() override;
+
+	ShapeSamplingResult sample(const Point2f& sample) const override;
+
+	ShapeSamplingResult sample(const Intersection& ref,
+	                           const Point2f& sample) const override;
+
+	std::string toString() const override;
+
+private:
+	std::string m_groupId;
+	const ShapeGroup* m_group = nullptr;
+	Transform m_toLocal;  ///< Inverse of the instance's transform
+};
+
+NORI_NAMESPACE_END
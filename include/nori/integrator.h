@@ -53,6 +53,48 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Sample the incident radiance along a camera ray whose first
+     * intersection is already known
+     *
+     * When \ref usesPrimaryHits() returns \c true, the camera rays of an
+     * image block are traced in coherent batches (see \ref Scene::rayIntersect())
+     * and this function is called instead of \ref Li() for each of them.
+     *
+     * \param its
+     *    The first intersection of the ray, or \c nullptr if the ray
+     *    doesn't hit the scene
+     * \param shadows
+     *    Shadow rays can be queued here instead of being traced right
+     *    away. The renderer traces them once the whole batch has been
+     *    shaded, and adds the radiance of the unoccluded ones.
+     * \param sample
+     *    Index of the sample to be passed to \ref ShadowQueue::add()
+     */
+    virtual Color3f LiPrimary(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                              const Intersection *its, ShadowQueue &shadows,
+                              uint32_t sample) const {
+        return Li(scene, sampler, ray);
+    }
+
+    /// Should the camera rays be traced in batches and passed to \ref LiPrimary()?
+    virtual bool usesPrimaryHits() const { return false; }
+
+    /**
+     * \brief Shade the hits of the paths of a wavefront
+     *
+     * This is called by the wavefront engine (see \ref Wavefront) once
+     * per bounce for all hits of the previous stage, when
+     * \ref supportsWavefront() returns \c true. Rather than tracing rays
+     * itself, the integrator adds radiance to the paths, queues shadow
+     * rays whose radiance is added if they aren't occluded (see
+     * \ref Wavefront::getShadows()), and extends paths by another ray.
+     */
+    virtual void shade(const Scene *scene, Sampler *sampler, Wavefront &wavefront) const { }
+
+    /// Can the integrator be used by the wavefront engine (see \ref shade())?
+    virtual bool supportsWavefront() const { return false; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
@@ -20,6 +20,9 @@
 
 #include <nori/shape.h>
 #include <nori/dpdf.h>
+#include <tbb/task_group.h>
+#include <functional>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
@@ -97,6 +100,9 @@ public:
 	/// Return a human-readable summary of this instance
 	std::string toString() const;
 
+	/// Wait until the loader started by \ref loadAsync() has finished
+	void waitUntilLoaded() override;
+
 	/**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
      * provided by this instance
@@ -123,12 +129,21 @@ protected:
 
 	void buildSamplingTable();
 
+	/**
+	 * \brief Fill the mesh in a TBB task, followed by \ref buildSamplingTable()
+	 *
+	 * The data of the mesh must not be accessed before \ref waitUntilLoaded()
+	 * has returned.
+	 */
+	void loadAsync(const std::function<void()> &load);
+
 private:
 	Point3f sampleTriangle(uint32_t index, const Point2f &sample,
 	                       Normal3f &normal) const;
 
 	float m_area;
 	DiscretePDF m_areaPDF;
+	std::unique_ptr<tbb::task_group> m_loading;  ///< Loader started by loadAsync()
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,105 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <functional>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Return the CPUs of every NUMA node of the machine
+ *
+ * The topology is read from <tt>/sys/devices/system/node</tt> on Linux.
+ * Other platforms (and machines without NUMA information) are reported
+ * as a single node containing all cores.
+ */
+extern std::vector<std::vector<int>> getNumaNodes();
+
+/**
+ * \brief Spread the memory allocated by the current thread across
+ * all NUMA nodes (Linux only)
+ *
+ * This is used while loading a scene, so that the read-only scene data
+ * (meshes, acceleration data structure) doesn't reside on a single node
+ * whose memory bandwidth is then shared by all threads. Threads that are
+ * created in the meantime inherit the policy.
+ */
+extern void setInterleavedAllocation(bool interleave);
+
+/**
+ * \brief Does the current thread spread its allocations across the
+ * NUMA nodes (see \ref setInterleavedAllocation())?
+ *
+ * Tasks that load scene data on other threads (e.g. meshes, see
+ * \ref Mesh::loadAsync()) use this to apply the same policy.
+ */
+extern bool isInterleavedAllocation();
+
+/**
+ * \brief Pins every thread that enters the TBB scheduler to its own core
+ *
+ * The threads are assigned to the cores (one node after the other) in
+ * the order in which they first start working while the object exists.
+ */
+class ThreadPinning {
+public:
+    ThreadPinning();
+    ~ThreadPinning();
+
+private:
+    class Observer;
+    std::unique_ptr<Observer> m_observer;
+};
+
+/**
+ * \brief One TBB task arena per NUMA node
+ *
+ * The threads of an arena are pinned to the cores of its node while
+ * they work in it, so that the memory they first touch (e.g. image
+ * blocks and samplers) is allocated on that node.
+ */
+class NumaArenas {
+public:
+    /// Create an arena for every node returned by \ref getNumaNodes()
+    NumaArenas();
+
+    ~NumaArenas();
+
+    /// Return the number of nodes
+    int getNodeCount() const { return (int) m_nodes.size(); }
+
+    /// Return the number of threads working in the arena of a node
+    int getThreadCount(int node) const;
+
+    /**
+     * \brief Run a function in every arena in parallel and wait until
+     * all of them have returned
+     *
+     * The function receives the index of the node
+     */
+    void run(const std::function<void(int)> &func);
+
+private:
+    struct Node;
+    std::vector<std::unique_ptr<Node>> m_nodes;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,210 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+#define NORI_SEED_SAMPLES (1u << 20) /* Samples per pixel reserved for every seed */
+#define NORI_MAX_SEED     4095       /* Largest seed whose samples fit into 32 bits */
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Options that control how a scene is rendered
+ *
+ * These are usually set from the command line (see <tt>main.cpp</tt>)
+ */
+struct RenderOptions {
+    /**
+     * \brief Render without a preview window
+     *
+     * No OpenGL context is created; progress is reported as text
+     * on the console instead.
+     */
+    bool headless = false;
+
+    /**
+     * \brief Wall-clock time budget in seconds
+     *
+     * When positive, this overrides the <tt>timeBudget</tt> property
+     * of the scene (see \ref Scene::getTimeBudget())
+     */
+    float timeBudget = 0;
+
+    /// Block order that overrides the scene's <tt>blockOrder</tt> (if not empty)
+    std::string blockOrder;
+
+    /// Pixel order that overrides the scene's <tt>pixelOrder</tt> (if not empty)
+    std::string pixelOrder;
+
+    /// Don't print progress information or a summary
+    bool quiet = false;
+
+    /// Save the rendered image (disabled e.g. for benchmarks)
+    bool writeOutput = true;
+
+    /**
+     * \brief Interval between checkpoints in seconds
+     *
+     * When positive, the partially rendered image is periodically saved
+     * to <tt>scene.checkpoint</tt> after a completed pass
+     */
+    float checkpointInterval = 0;
+
+    /// Continue from the checkpoint of a previous, interrupted rendering
+    bool resume = false;
+
+    /**
+     * \brief Additionally save the unnormalized image
+     *
+     * The file <tt>scene.weighted.exr</tt> contains the weighted sums of
+     * the samples and the filter weights, so that independent renderings
+     * of the same scene can be combined (see \ref ImageBlock::saveWeighted())
+     */
+    bool weightedOutput = false;
+
+    /**
+     * \brief Seed of the sample sequences (0 .. \ref NORI_MAX_SEED)
+     *
+     * A rendering with seed \c s takes the sample indices starting at
+     * <tt>s * NORI_SEED_SAMPLES</tt>, so that renderings of the same scene
+     * with different seeds (and fewer samples per pixel than that) are
+     * independent and can be combined using nori-merge. The seed is
+     * stored in the header of the output.
+     */
+    uint32_t seed = 0;
+
+    /**
+     * \brief Pad the output of a cropped rendering to the full image size
+     *
+     * Pixels outside of the crop window (see \ref Camera::setCropWindow())
+     * are black and have a weight of zero. Together with \ref weightedOutput,
+     * this adds samples to a region of a full-frame rendering when the two
+     * are combined using nori-merge. The crop window must then be rendered
+     * with a different \ref seed, since its pixels otherwise receive the
+     * same samples as in the full frame.
+     */
+    bool padCrop = false;
+
+    /**
+     * \brief Measure the time spent on every pixel
+     *
+     * The times are saved to <tt>scene.cost.exr</tt> (in microseconds),
+     * and the slowest blocks are listed after rendering
+     */
+    bool costMap = false;
+
+    /**
+     * \brief Render each horizontal strip of the image using the
+     * cores of one NUMA node (see \ref NumaArenas)
+     */
+    bool numa = false;
+
+    /**
+     * \brief Trace the camera rays of a block in coherent batches
+     *
+     * Only used by integrators that support it (see
+     * \ref Integrator::usesPrimaryHits()), and not together with
+     * \ref costMap, which times every pixel on its own
+     */
+    bool packets = true;
+
+    /**
+     * \brief Render the paths of a block in bulk, one stage at a time
+     * (see \ref Wavefront)
+     *
+     * Only used by integrators that support it (see
+     * \ref Integrator::supportsWavefront()), and not together with
+     * \ref costMap
+     */
+    bool wavefront = false;
+
+    /**
+     * \brief Number of rays that are sorted together by the wavefront
+     * engine before tracing and shading them (0: no sorting)
+     *
+     * See \ref Wavefront::setSortBatch()
+     */
+    int sortBatch = 0;
+};
+
+/**
+ * \brief Render a scene and save the result as an OpenEXR file
+ *
+ * \param scene
+ *     The scene to be rendered
+ * \param filename
+ *     Filename of the scene description. The output is written next
+ *     to it, with the extension replaced by <tt>.exr</tt>
+ * \param options
+ *     Additional rendering options
+ */
+extern void render(Scene *scene, const std::string &filename,
+                   const RenderOptions &options);
+
+/**
+ * \brief Return the part of the image that needs to be rendered
+ *
+ * This is the crop window of the camera, extended by the border of
+ * the reconstruction filter (within the image bounds). That way, the
+ * pixels at the edge of the crop window receive the samples of all
+ * pixels that they overlap, as in a rendering of the entire image.
+ */
+extern void getRenderRegion(const Scene *scene, Point2i &offset, Vector2i &size);
+
+/**
+ * \brief Save a rendered image next to the scene description
+ *
+ * \param scene
+ *     The rendered scene, whose camera determines the crop window
+ * \param image
+ *     The rendered image, which covers the region returned
+ *     by \ref getRenderRegion()
+ * \param filename
+ *     Filename of the scene description (see \ref render())
+ * \param options
+ *     Determines whether the weighted image is saved as well
+ * \param sampleCount
+ *     Samples per pixel, stored along with the render time in the header
+ * \param renderTime
+ *     Render time in milliseconds
+ */
+extern void saveImage(const Scene *scene, const ImageBlock &image, const std::string &filename,
+                      const RenderOptions &options, uint32_t sampleCount,
+                      double renderTime);
+
+/**
+ * \brief Render a single block of the image
+ *
+ * The block is cleared, and every pixel then receives the samples
+ * <tt>sampleIndex .. sampleIndex + sampleCount - 1</tt>. This is used
+ * by worker processes when rendering in distributed mode.
+ */
+extern void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                        uint32_t sampleIndex, uint32_t sampleCount);
+
+/**
+ * \brief Check whether a preview window can be opened
+ *
+ * Returns \c false on Unix machines without a display server
+ * (e.g. render nodes), where the GUI would fail to initialize.
+ */
+extern bool isDisplayAvailable();
+
+NORI_NAMESPACE_END
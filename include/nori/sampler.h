@@ -19,12 +19,11 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/block.h>
 #include <memory>
 
 NORI_NAMESPACE_BEGIN
 
-class ImageBlock;
-
 /**
  * \brief Abstract sample generator
  *
@@ -74,8 +73,29 @@ public:
      * a new image block. This can be used to deterministically
      * initialize the sampler so that repeated program runs
      * always create the same image.
+     *
+     * \param block
+     *     The image block that is about to be rendered
+     * \param sampleIndex
+     *     Index of the first pixel sample that will be taken. When an
+     *     image is rendered in several passes, each pass visits the
+     *     same blocks again; the sampler must then produce samples that
+     *     are independent of those of the earlier passes.
+     */
+    void prepare(const ImageBlock &block, uint32_t sampleIndex) {
+        prepare(block.getOffset(), sampleIndex);
+    }
+
+    /**
+     * \brief Prepare to render a region of an image block
+     *
+     * Like \ref prepare(const ImageBlock &, uint32_t), but for a region
+     * that starts at the given pixel offset within the image. The blocks
+     * are rendered region by region, and each region has its own sample
+     * sequence, so that the result doesn't depend on which of them are
+     * handed to other threads.
      */
-    virtual void prepare(const ImageBlock &block) = 0;
+    virtual void prepare(const Point2i &offset, uint32_t sampleIndex) = 0;
 
     /**
      * \brief Prepare to generate new samples
@@ -20,9 +20,12 @@
 
 #include <nori/accel.h>
 #include <nori/dpdf.h>
+#include <nori/block.h>
 #include <embree3/rtcore.h>
 #include <unordered_map>
 
+#define NORI_RAY_BATCH 64 /* Number of coherent rays that are traced together */
+
 NORI_NAMESPACE_BEGIN
 
 /**
@@ -52,6 +55,9 @@ public:
 	/// Return a pointer to the scene's camera
 	const Camera *getCamera() const { return m_camera; }
 
+	/// Return a pointer to the scene's camera
+	Camera *getCamera() { return m_camera; }
+
 	/// Return a pointer to the scene's sample generator (const version)
 	const Sampler *getSampler() const { return m_sampler; }
 
@@ -66,6 +72,47 @@ public:
 
 	const DiscretePDF &getEmitterPDF() const { return m_emitterPDF; }
 
+	/**
+	 * \brief Should the image be rendered in several passes?
+	 *
+	 * Progressive rendering is implied by adaptive sampling
+	 */
+	bool isProgressive() const { return m_progressive || m_adaptiveThreshold > 0; }
+
+	/// Return the number of samples per pixel taken in each progressive pass
+	uint32_t getPassSampleCount() const { return m_passSampleCount; }
+
+	/**
+	 * \brief Return the relative error below which a pixel is considered
+	 * converged and receives no further samples (0: adaptive sampling disabled)
+	 */
+	float getAdaptiveThreshold() const { return m_adaptiveThreshold; }
+
+	/// Return the number of samples every pixel receives before it may be considered converged
+	uint32_t getAdaptiveMinSamples() const { return m_adaptiveMinSamples; }
+
+	/**
+	 * \brief Return the wall-clock time budget in seconds (0: none)
+	 *
+	 * With a time budget, progressive passes are rendered until the
+	 * budget is used up; the sample count of the sampler is ignored.
+	 * A pass that has been started is always completed, so that all
+	 * pixels receive the same number of samples.
+	 */
+	float getTimeBudget() const { return m_timeBudget; }
+
+	/**
+	 * \brief Return the edge length of the image blocks that are
+	 * rendered in parallel (0: choose automatically)
+	 */
+	int getBlockSize() const { return m_blockSize; }
+
+	/// Return the order in which the image blocks are rendered
+	ETraversalOrder getBlockOrder() const { return m_blockOrder; }
+
+	/// Return the order in which the pixels within a block are rendered
+	ETraversalOrder getPixelOrder() const { return m_pixelOrder; }
+
 	/**
      * \brief Intersect a ray against all triangles stored in the scene
      * and return detailed intersection information
@@ -104,10 +151,77 @@ public:
 		return rayIntersect(ray, its, true);
 	}
 
+	/**
+     * \brief Intersect a batch of rays against the scene
+     *
+     * The rays are handed to Embree as streams of up to \ref NORI_RAY_BATCH
+     * rays. Coherent rays (e.g. the camera rays of an image block) are
+     * traced in packets, which is much faster than tracing them one by one.
+     *
+     * \param rays
+     *    An array of \c count rays
+     *
+     * \param its
+     *    An array of \c count intersection records, which will be filled
+     *    for every ray that hits the scene
+     *
+     * \param found
+     *    An array of \c count flags, which will be set to \c true for
+     *    every ray that hits the scene
+     *
+     * \param coherent
+     *    Do the rays have similar origins and directions?
+     */
+	void rayIntersect(const Ray3f *rays, Intersection *its, bool *found, size_t count,
+	                  bool coherent = true) const;
+
+	/**
+     * \brief Determine for a batch of rays whether they intersect the
+     * scene, without providing any further information
+     *
+     * This is the batched version of \ref rayIntersect(const Ray3f &) const
+     * for shadow rays, which are handed to Embree as streams.
+     *
+     * \param occluded
+     *    An array of \c count flags, which will be set to \c true for
+     *    every ray that hits the scene
+     */
+	void rayOccluded(const Ray3f *rays, bool *occluded, size_t count) const;
+
+	/**
+	 * \brief Change how the Embree BVH is built and rebuild it
+	 *
+	 * \param flags
+	 *    Comma-separated scene flags ("robust", "compact" and "dynamic")
+	 *    or "none"
+	 *
+	 * \param quality
+	 *    Build quality of the geometries ("low", "medium", "high" or
+	 *    "refit"). The BVH over the geometries is built with the same
+	 *    quality, or "medium" for "refit".
+	 */
+	void setBuildOptions(const std::string &flags, const std::string &quality);
+
+	/**
+	 * \brief Choose the acceleration data structure and rebuild it
+	 *
+	 * \param name
+	 *    "embree" or "bvh" (the BVH of \ref Accel, which doesn't support
+	 *    shape groups and instances)
+	 */
+	void setAccel(const std::string &name);
+
+	/// Is the scene traced using Embree (or using \ref Accel)?
+	bool usesEmbree() const { return m_useEmbree; }
+
+	/// Return the time it took to build the BVH in milliseconds
+	double getBuildTime() const { return m_buildTime; }
+
+	/// Return the memory that was allocated for the BVH (in bytes)
+	size_t getBuildMemory() const { return m_buildMemory; }
+
 	/// \brief Return an axis-aligned box that bounds the scene
-	const BoundingBox3f &getBoundingBox() const {
-		return m_accel->getBoundingBox();
-	}
+	const BoundingBox3f &getBoundingBox() const { return m_bbox; }
 
 	/**
      * \brief Inherited from \ref NoriObject::activate()
@@ -131,10 +245,28 @@ private:
 		uint32_t geomID;
 	};
 
+	/// Embree scene of a shape group, shared by all of its instances
+	struct GroupData {
+		RTCScene scene;
+		// geomID (in the group's scene) --> ShapeData
+		std::unordered_map<uint32_t, ShapeData> shapeIDs;
+	};
+
+	struct InstanceData {
+		const Instance *instance;
+		const GroupData *group;
+	};
+
 	void build();
+	void release();
+	void attachShape(RTCScene scene, Shape *shape,
+	                 std::unordered_map<uint32_t, ShapeData> &shapeIDs);
 	bool rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const;
+	void setHitInformation(const Ray3f &ray, const RTCRayHit &rayhit, Intersection &its) const;
 
 	std::vector<Shape *> m_shapes;
+	std::vector<ShapeGroup *> m_groups;
+	std::vector<Instance *> m_instances;
 	std::vector<Emitter *> m_emitters;
 	Integrator *m_integrator = nullptr;
 	Sampler *m_sampler = nullptr;
@@ -142,11 +274,33 @@ private:
 	Accel *m_accel = nullptr;
 
 	DiscretePDF m_emitterPDF;
-
+	BoundingBox3f m_bbox;
+
+	bool m_progressive;
+	uint32_t m_passSampleCount;
+	float m_adaptiveThreshold;
+	uint32_t m_adaptiveMinSamples;
+	float m_timeBudget;
+	int m_blockSize;
+	ETraversalOrder m_blockOrder;
+	ETraversalOrder m_pixelOrder;
+
+	bool m_useEmbree;
+	bool m_built = false;
 	RTCScene m_scene = nullptr;  // Embree scene
+	RTCSceneFlags m_sceneFlags;
+	RTCBuildQuality m_buildQuality;
+	double m_buildTime = 0;
+	size_t m_buildMemory = 0;
 
 	// geomID --> ShapeData
 	std::unordered_map<uint32_t, ShapeData> m_shapeIDs;
+
+	// group id --> GroupData
+	std::unordered_map<std::string, GroupData> m_groupData;
+
+	// geomID (of the instance) --> InstanceData
+	std::unordered_map<uint32_t, InstanceData> m_instanceIDs;
 };
 
 NORI_NAMESPACE_END
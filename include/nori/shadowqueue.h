@@ -0,0 +1,80 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/ray.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Deferred occlusion queries
+ *
+ * Instead of tracing a shadow ray right away, an integrator can queue it
+ * together with the radiance that it carries if it turns out to be
+ * unoccluded. The renderer traces all queued rays in bulk (see
+ * \ref Scene::rayOccluded()), which amortizes the cost of dispatching
+ * them, and then adds the radiance of the unoccluded rays to the samples
+ * they belong to.
+ */
+class ShadowQueue {
+public:
+    /**
+     * \brief Queue a shadow ray
+     *
+     * \param sample
+     *     Index of the sample whose radiance is increased by \c value
+     *     unless the ray is occluded (see \ref resolve())
+     */
+    void add(uint32_t sample, const Ray3f &ray, const Color3f &value) {
+        m_rays.push_back(ray);
+        m_samples.push_back(sample);
+        m_values.push_back(value);
+    }
+
+    /// Return the number of queued rays
+    size_t size() const { return m_rays.size(); }
+
+    /// Is the queue empty?
+    bool isEmpty() const { return m_rays.empty(); }
+
+    /**
+     * \brief Trace all queued rays and add the radiance of the unoccluded
+     * ones to the radiance of their samples
+     *
+     * The queue is empty afterwards.
+     *
+     * \param radiance
+     *     Radiance of the samples, indexed by the sample index passed
+     *     to \ref add()
+     */
+    void resolve(const Scene *scene, Color3f *radiance);
+
+private:
+    friend class Wavefront; /* Sorts the queued rays */
+
+    std::vector<Ray3f> m_rays;
+    std::vector<uint32_t> m_samples;
+    std::vector<Color3f> m_values;
+    std::unique_ptr<bool[]> m_occluded;
+    size_t m_capacity = 0;
+};
+
+NORI_NAMESPACE_END
@@ -30,10 +30,12 @@ struct Intersection {
 	Frame geoFrame;
 	/// Pointer to the associated mesh
 	const Shape* shape;
+	/// Transform of the instance whose shape was hit (\c nullptr if not instanced)
+	const Transform* instance;
 
 	/// Create an uninitialized intersection record
 	Intersection() :
-	    shape(nullptr) {}
+	    shape(nullptr), instance(nullptr) {}
 
 	/// Transform a direction vector into the local shading frame
 	Vector3f toLocal(const Vector3f& d) const {
@@ -121,6 +123,16 @@ public:
 	/// Initialize internal data structures (called once by the XML parser)
 	virtual void activate() override;
 
+	/**
+	@brief Wait until the data of the shape (e.g. its bounding box) is
+	available
+
+	Shapes that load large files do so in the background, so that they
+	are loaded in parallel while the rest of the XML file is parsed.
+	Errors of the loader are rethrown here.
+	*/
+	virtual void waitUntilLoaded() {}
+
 	/**
 	@brief Ray-shape intersection test
 
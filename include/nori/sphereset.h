@@ -0,0 +1,76 @@
+#pragma once
+
+#include <nori/shape.h>
+#include <nori/dpdf.h>
+#include <embree3/rtcore.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+@brief A set of spheres that forms a single shape (e.g. particles or
+sphere packs)
+
+The spheres are either loaded from a binary file ('filename': the number
+of spheres as a 32-bit unsigned integer, followed by the center and radius
+of every sphere as four 32-bit floats) or listed in the XML ('centers':
+x y z triples, and 'radii' or a common 'radius'). The 'toWorld' transform
+moves the centers, the radii are not scaled.
+
+All spheres end up in one Embree geometry with one primitive per sphere,
+which uses Embree's native spheres where they are available and user
+callbacks that process N rays at once otherwise.
+*/
+class SphereSet : public Shape {
+
+public:
+	SphereSet(const PropertyList& props);
+
+	/// Return the number of spheres
+	uint32_t getSphereCount() const { return (uint32_t)m_spheres.cols(); }
+
+	/// Return the center (xyz) and radius (w) of every sphere, one per column
+	const MatrixXf& getSpheres() const { return m_spheres; }
+
+	/**
+	@brief Create the (uncommitted) Embree geometry of the spheres
+
+	The geometry refers to the sphere data of this shape, which must
+	outlive it.
+	*/
+	RTCGeometry createGeometry(RTCDevice device) const;
+
+	float area() const override { return m_area; }
+
+	/**
+	@brief Ray-sphere intersection test
+
+	@param index	Index of the sphere that should be intersected
+	@param ray		The ray segment to be used for the intersection query
+	@param t		The distance from the ray origin to the intersection point if success
+
+	@return			True if an intersection has been detected
+	*/
+	bool rayIntersect(uint32_t index, const Ray3f& ray, float& t) const;
+
+	void setHitInformation(const Ray3f& ray, const float& t, const RTCHit& hit,
+	                       Intersection& its) const override;
+
+	ShapeSamplingResult sample(const Point2f& sample) const override;
+
+	ShapeSamplingResult sample(const Intersection& ref,
+	                           const Point2f& sample) const override;
+
+	std::string toString() const override;
+
+private:
+	void loadBinary(const std::string& filename);
+
+	void loadList(const PropertyList& props);
+
+	MatrixXf m_spheres;  ///< Centers and radii (4 x count)
+
+	float m_area;
+	DiscretePDF m_areaPDF;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <nori/common.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+@brief Event counter that can be incremented from many threads at once
+
+Every thread writes to its own slot, so that incrementing the counter
+in the inner rendering loop never causes cache line ping-pong. The
+total is only assembled when \ref value() is called.
+*/
+class StatsCounter {
+
+public:
+	/// Add an amount to the slot of the calling thread
+	void add(uint64_t amount = 1) {
+		auto &slot = m_slots.local().value;
+		slot.store(slot.load(std::memory_order_relaxed) + amount,
+		           std::memory_order_relaxed);
+	}
+
+	/// Return the sum over all threads
+	uint64_t value() const {
+		uint64_t sum = 0;
+		for (auto &slot : m_slots)
+			sum += slot.value.load(std::memory_order_relaxed);
+		return sum;
+	}
+
+private:
+	struct Slot {
+		std::atomic<uint64_t> value{0};
+
+		Slot() {}
+		Slot(const Slot &other) :
+		    value(other.value.load()) {}
+	};
+
+	tbb::enumerable_thread_specific<Slot, tbb::cache_aligned_allocator<Slot>,
+	                                tbb::ets_key_per_instance>
+	  m_slots;
+};
+
+/**
+@brief Quantity that goes up and down (e.g. allocated memory), which
+also keeps track of its maximum
+
+Unlike \ref StatsCounter, a gauge is a single shared value and hence
+not meant for the inner rendering loop.
+*/
+class StatsGauge {
+
+public:
+	/// Add a (possibly negative) amount
+	void add(int64_t amount) {
+		int64_t value = m_value.fetch_add(amount, std::memory_order_relaxed) + amount;
+		int64_t peak = m_peak.load(std::memory_order_relaxed);
+		while (value > peak &&
+		       !m_peak.compare_exchange_weak(peak, value, std::memory_order_relaxed)) {
+		}
+	}
+
+	/// Return the current value
+	int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+	/// Return the largest value so far
+	int64_t peak() const { return m_peak.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<int64_t> m_value{0};
+	std::atomic<int64_t> m_peak{0};
+};
+
+/**
+@brief Singleton that holds the global rendering statistics
+*/
+class Statistics {
+
+public:
+	static Statistics &instance() {
+		static Statistics _instance;
+		return _instance;
+	}
+
+	Statistics(const Statistics &) = delete;
+	Statistics &operator=(const Statistics &) = delete;
+
+	StatsCounter rays;          ///< Intersection queries of any kind
+	StatsCounter shadowRays;    ///< Occlusion-only queries
+	StatsCounter samples;       ///< Camera samples
+	StatsCounter embreeErrors;  ///< Errors reported by Embree
+	StatsGauge embreeMemory;    ///< Memory allocated by Embree (in bytes)
+
+private:
+	Statistics() {}
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,258 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/ray.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#define NORI_TRIANGLE_PACK 8 /* Number of triangles that are tested at once */
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Precomputed records of up to 8 triangles, which are intersected
+ * with a ray at once
+ *
+ * The records store the first vertex and the two edges that share it in
+ * a structure-of-arrays layout, so that the Moeller-Trumbore test (see
+ * \ref Mesh::rayIntersect()) neither needs to gather the vertices through
+ * the index buffer nor to recompute the edges. When compiled for AVX2
+ * (see the \c NORI_USE_AVX2 CMake option), all 8 triangles are tested
+ * with one instruction stream, with SSE2 (i.e. on any x86-64 machine) in
+ * two halves of 4 triangles, and otherwise one after the other.
+ */
+struct alignas(32) TrianglePack {
+    float v0[3][NORI_TRIANGLE_PACK]; ///< First vertex (x, y, z)
+    float e1[3][NORI_TRIANGLE_PACK]; ///< Edge from the first to the second vertex
+    float e2[3][NORI_TRIANGLE_PACK]; ///< Edge from the first to the third vertex
+    uint32_t id[NORI_TRIANGLE_PACK]; ///< User-defined identifier of every triangle
+
+    /// Create a pack with only unused slots
+    TrianglePack() {
+        for (int i = 0; i < NORI_TRIANGLE_PACK; ++i)
+            clear(i);
+    }
+
+    /// Store a triangle in the given slot
+    void set(int slot, const Point3f &p0, const Point3f &p1, const Point3f &p2, uint32_t id_) {
+        for (int k = 0; k < 3; ++k) {
+            v0[k][slot] = p0[k];
+            e1[k][slot] = p1[k] - p0[k];
+            e2[k][slot] = p2[k] - p0[k];
+        }
+        id[slot] = id_;
+    }
+
+    /// Mark a slot as unused (its degenerate triangle is never hit)
+    void clear(int slot) {
+        for (int k = 0; k < 3; ++k)
+            v0[k][slot] = e1[k][slot] = e2[k][slot] = 0.0f;
+        id[slot] = (uint32_t) -1;
+    }
+
+    /**
+     * \brief Intersect a ray against all triangles of the pack and
+     * return the nearest hit
+     *
+     * \param t
+     *    Upon success, the distance from the ray origin to the intersection
+     *    point, which lies within <tt>[ray.mint, ray.maxt]</tt>
+     * \param u
+     *    Upon success, the 'U' component of the intersection in barycentric
+     *    coordinates
+     * \param v
+     *    Upon success, the 'V' component of the intersection in barycentric
+     *    coordinates
+     * \return
+     *    The slot of the nearest hit triangle, or -1 if there is none
+     */
+    int rayIntersect(const Ray3f &ray, float &t, float &u, float &v) const;
+};
+
+#if defined(__AVX2__)
+
+inline int TrianglePack::rayIntersect(const Ray3f &ray, float &t, float &u, float &v) const {
+    const __m256 ox = _mm256_set1_ps(ray.o.x()), oy = _mm256_set1_ps(ray.o.y()), oz = _mm256_set1_ps(ray.o.z());
+    const __m256 dx = _mm256_set1_ps(ray.d.x()), dy = _mm256_set1_ps(ray.d.y()), dz = _mm256_set1_ps(ray.d.z());
+    const __m256 e1x = _mm256_loadu_ps(e1[0]), e1y = _mm256_loadu_ps(e1[1]), e1z = _mm256_loadu_ps(e1[2]);
+    const __m256 e2x = _mm256_loadu_ps(e2[0]), e2y = _mm256_loadu_ps(e2[1]), e2z = _mm256_loadu_ps(e2[2]);
+
+    /* pvec = d x e2, det = e1 . pvec */
+    __m256 px = _mm256_fmsub_ps(dy, e2z, _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_fmsub_ps(dz, e2x, _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_fmsub_ps(dx, e2y, _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_fmadd_ps(e1x, px, _mm256_fmadd_ps(e1y, py, _mm256_mul_ps(e1z, pz)));
+    __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    /* tvec = o - v0, u = (tvec . pvec) / det */
+    __m256 tx = _mm256_sub_ps(ox, _mm256_loadu_ps(v0[0]));
+    __m256 ty = _mm256_sub_ps(oy, _mm256_loadu_ps(v0[1]));
+    __m256 tz = _mm256_sub_ps(oz, _mm256_loadu_ps(v0[2]));
+    __m256 uu = _mm256_mul_ps(_mm256_fmadd_ps(tx, px, _mm256_fmadd_ps(ty, py, _mm256_mul_ps(tz, pz))), invDet);
+
+    /* qvec = tvec x e1, v = (d . qvec) / det, t = (e2 . qvec) / det */
+    __m256 qx = _mm256_fmsub_ps(ty, e1z, _mm256_mul_ps(tz, e1y));
+    __m256 qy = _mm256_fmsub_ps(tz, e1x, _mm256_mul_ps(tx, e1z));
+    __m256 qz = _mm256_fmsub_ps(tx, e1y, _mm256_mul_ps(ty, e1x));
+    __m256 vv = _mm256_mul_ps(_mm256_fmadd_ps(dx, qx, _mm256_fmadd_ps(dy, qy, _mm256_mul_ps(dz, qz))), invDet);
+    __m256 tt = _mm256_mul_ps(_mm256_fmadd_ps(e2x, qx, _mm256_fmadd_ps(e2y, qy, _mm256_mul_ps(e2z, qz))), invDet);
+
+    /* Same conditions as the scalar test (|det| > 1e-8 etc.) */
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 mask = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(uu, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(uu, one, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(vv, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(uu, vv), one, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(tt, _mm256_set1_ps(ray.mint), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(tt, _mm256_set1_ps(ray.maxt), _CMP_LE_OQ));
+    if (_mm256_testz_ps(mask, mask))
+        return -1;
+
+    /* Find the nearest hit: broadcast the minimum over all lanes */
+    __m256 tm = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), tt, mask);
+    __m256 tmin = _mm256_min_ps(tm, _mm256_permute_ps(tm, _MM_SHUFFLE(2, 3, 0, 1)));
+    tmin = _mm256_min_ps(tmin, _mm256_permute_ps(tmin, _MM_SHUFFLE(1, 0, 3, 2)));
+    tmin = _mm256_min_ps(tmin, _mm256_permute2f128_ps(tmin, tmin, 0x01));
+    int lanes = _mm256_movemask_ps(_mm256_and_ps(mask, _mm256_cmp_ps(tm, tmin, _CMP_EQ_OQ)));
+    int slot = 0;
+    while (!(lanes & (1 << slot)))
+        ++slot;
+
+    alignas(32) float tv[NORI_TRIANGLE_PACK], uv[NORI_TRIANGLE_PACK], vv_[NORI_TRIANGLE_PACK];
+    _mm256_store_ps(tv, tt);
+    _mm256_store_ps(uv, uu);
+    _mm256_store_ps(vv_, vv);
+    t = tv[slot];
+    u = uv[slot];
+    v = vv_[slot];
+    return slot;
+}
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+inline int TrianglePack::rayIntersect(const Ray3f &ray, float &t, float &u, float &v) const {
+    const __m128 ox = _mm_set1_ps(ray.o.x()), oy = _mm_set1_ps(ray.o.y()), oz = _mm_set1_ps(ray.o.z());
+    const __m128 dx = _mm_set1_ps(ray.d.x()), dy = _mm_set1_ps(ray.d.y()), dz = _mm_set1_ps(ray.d.z());
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), eps = _mm_set1_ps(1e-8f);
+    const __m128 mint = _mm_set1_ps(ray.mint), signMask = _mm_set1_ps(-0.0f);
+
+    alignas(16) float tt[NORI_TRIANGLE_PACK], uu[NORI_TRIANGLE_PACK], vv[NORI_TRIANGLE_PACK];
+    int lanes = 0;
+    for (int h = 0; h < NORI_TRIANGLE_PACK; h += 4) {
+        const __m128 e1x = _mm_loadu_ps(e1[0] + h), e1y = _mm_loadu_ps(e1[1] + h), e1z = _mm_loadu_ps(e1[2] + h);
+        const __m128 e2x = _mm_loadu_ps(e2[0] + h), e2y = _mm_loadu_ps(e2[1] + h), e2z = _mm_loadu_ps(e2[2] + h);
+
+        /* pvec = d x e2, det = e1 . pvec */
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_mul_ps(e1x, px), _mm_add_ps(_mm_mul_ps(e1y, py), _mm_mul_ps(e1z, pz)));
+        __m128 invDet = _mm_div_ps(one, det);
+
+        /* tvec = o - v0, u = (tvec . pvec) / det */
+        __m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(v0[0] + h));
+        __m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(v0[1] + h));
+        __m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(v0[2] + h));
+        __m128 u4 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_add_ps(_mm_mul_ps(ty, py), _mm_mul_ps(tz, pz))), invDet);
+
+        /* qvec = tvec x e1, v = (d . qvec) / det, t = (e2 . qvec) / det */
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        __m128 v4 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_add_ps(_mm_mul_ps(dy, qy), _mm_mul_ps(dz, qz))), invDet);
+        __m128 t4 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_add_ps(_mm_mul_ps(e2y, qy), _mm_mul_ps(e2z, qz))), invDet);
+
+        __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(signMask, det), eps);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u4, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(u4, one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v4, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u4, v4), one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(t4, mint));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(t4, _mm_set1_ps(ray.maxt)));
+        lanes |= _mm_movemask_ps(mask) << h;
+
+        _mm_store_ps(tt + h, t4);
+        _mm_store_ps(uu + h, u4);
+        _mm_store_ps(vv + h, v4);
+    }
+    if (lanes == 0)
+        return -1;
+
+    int slot = -1;
+    for (int i = 0; i < NORI_TRIANGLE_PACK; ++i) {
+        if ((lanes & (1 << i)) && (slot < 0 || tt[i] < tt[slot]))
+            slot = i;
+    }
+    t = tt[slot];
+    u = uu[slot];
+    v = vv[slot];
+    return slot;
+}
+
+#else
+
+inline int TrianglePack::rayIntersect(const Ray3f &ray, float &t, float &u, float &v) const {
+    float tt[NORI_TRIANGLE_PACK], uu[NORI_TRIANGLE_PACK], vv[NORI_TRIANGLE_PACK];
+    bool hit[NORI_TRIANGLE_PACK];
+
+    /* Moeller-Trumbore without branches, so that the loop can be vectorized */
+    for (int i = 0; i < NORI_TRIANGLE_PACK; ++i) {
+        float px = ray.d.y() * e2[2][i] - ray.d.z() * e2[1][i];
+        float py = ray.d.z() * e2[0][i] - ray.d.x() * e2[2][i];
+        float pz = ray.d.x() * e2[1][i] - ray.d.y() * e2[0][i];
+        float det = e1[0][i] * px + e1[1][i] * py + e1[2][i] * pz;
+        float invDet = 1.0f / det;
+
+        float tx = ray.o.x() - v0[0][i], ty = ray.o.y() - v0[1][i], tz = ray.o.z() - v0[2][i];
+        uu[i] = (tx * px + ty * py + tz * pz) * invDet;
+
+        float qx = ty * e1[2][i] - tz * e1[1][i];
+        float qy = tz * e1[0][i] - tx * e1[2][i];
+        float qz = tx * e1[1][i] - ty * e1[0][i];
+        vv[i] = (ray.d.x() * qx + ray.d.y() * qy + ray.d.z() * qz) * invDet;
+        tt[i] = (e2[0][i] * qx + e2[1][i] * qy + e2[2][i] * qz) * invDet;
+
+        hit[i] = std::abs(det) >= 1e-8f && uu[i] >= 0.0f && uu[i] <= 1.0f &&
+                 vv[i] >= 0.0f && uu[i] + vv[i] <= 1.0f &&
+                 tt[i] >= ray.mint && tt[i] <= ray.maxt;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < NORI_TRIANGLE_PACK; ++i) {
+        if (hit[i] && (slot < 0 || tt[i] < tt[slot]))
+            slot = i;
+    }
+    if (slot >= 0) {
+        t = tt[slot];
+        u = uu[slot];
+        v = vv[slot];
+    }
+    return slot;
+}
+
+#endif
+
+NORI_NAMESPACE_END
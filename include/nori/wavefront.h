@@ -0,0 +1,180 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/shape.h>
+#include <nori/shadowqueue.h>
+#include <memory>
+#include <unordered_map>
+
+#define NORI_WAVEFRONT_SIZE 4096 /* Number of paths that are rendered together */
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief A batch of paths that are rendered together, one stage at a time
+ *
+ * Rather than following one path from the camera to the light sources
+ * before starting the next one (as \ref Integrator::Li() does), the
+ * wavefront engine advances all of its paths by one stage at a time:
+ * the camera rays are traced as one stream, all hits are shaded, and the
+ * extension and shadow rays that were produced by shading are again
+ * traced in bulk, until no path is left. This keeps the ray tracing
+ * kernels busy with large, independent workloads and amortizes the cost
+ * of dispatching them.
+ *
+ * The paths are stored as a structure of arrays. Integrators implement
+ * \ref Integrator::shade(), which is called for every bounce and uses
+ * the accessors below to inspect the hits and to continue the paths.
+ */
+class Wavefront {
+public:
+    /// Allocate the queues for \ref NORI_WAVEFRONT_SIZE paths
+    Wavefront();
+
+    /**
+     * \brief Sort the rays before they are traced, and the hits before
+     * they are shaded, in windows of the given number of rays (0: never)
+     *
+     * Extension and shadow rays are sorted by the octant of their
+     * direction and the cell of their origin (in a grid over the origins
+     * within the window), so that consecutive rays traverse similar parts
+     * of the scene. Hits are grouped by BSDF and shape, so that their data
+     * stays in the caches while shading. Larger windows find more
+     * coherence, but sorting them takes longer.
+     */
+    void setSortBatch(size_t sortBatch) { m_sortBatch = sortBatch; }
+
+    /// Is there room for another path?
+    bool isFull() const { return m_pixelSamples.size() == NORI_WAVEFRONT_SIZE; }
+
+    /// Is the wavefront empty?
+    bool isEmpty() const { return m_pixelSamples.empty(); }
+
+    /**
+     * \brief Start a new path
+     *
+     * \param pixelSample
+     *     Position on the image plane where the radiance is recorded
+     * \param ray
+     *     Camera ray
+     * \param weight
+     *     Importance weight of the camera ray
+     */
+    void addPath(const Point2f &pixelSample, const Ray3f &ray, const Color3f &weight);
+
+    /**
+     * \brief Render all paths and store their radiance in an image block
+     *
+     * The wavefront is empty afterwards.
+     */
+    void render(const Scene *scene, Sampler *sampler, ImageBlock &block);
+
+    /// Return the number of surface interactions before the current hits
+    int getDepth() const { return m_depth; }
+
+    /// Return the number of rays whose hits are shaded
+    size_t getHitCount() const { return m_hitPaths.size(); }
+
+    /// Return the path that the i-th hit belongs to
+    uint32_t getPath(size_t i) const { return m_hitPaths[i]; }
+
+    /// Return the ray of the i-th hit
+    const Ray3f &getRay(size_t i) const { return m_hitRays[i]; }
+
+    /// Return the i-th intersection (or \c nullptr if the ray missed the scene)
+    const Intersection *getHit(size_t i) const { return m_found[i] ? &m_its[i] : nullptr; }
+
+    /// Add radiance to a path
+    void addRadiance(uint32_t path, const Color3f &value) { m_radiance[path] += value; }
+
+    /**
+     * \brief Continue a path along a ray
+     *
+     * The ray is traced in the next stage, and its hit is shaded in the
+     * next call to \ref Integrator::shade()
+     */
+    void extend(uint32_t path, const Ray3f &ray) {
+        m_rays.push_back(ray);
+        m_paths.push_back(path);
+    }
+
+    /**
+     * \brief Return the queue of shadow rays, which are traced after all
+     * hits have been shaded
+     *
+     * The sample index passed to \ref ShadowQueue::add() is the path
+     */
+    ShadowQueue &getShadows() { return m_shadows; }
+
+    /// Throughput of a path (can be used freely by the integrator)
+    Color3f &throughput(uint32_t path) { return m_throughput[path]; }
+
+    /// Pdf of the last sampled direction of a path (can be used freely by the integrator)
+    float &pdf(uint32_t path) { return m_pdf[path]; }
+
+    /// Last surface interaction of a path (can be used freely by the integrator)
+    Intersection &vertex(uint32_t path) { return m_vertex[path]; }
+
+private:
+    /// Sort a queue of rays (and the values that belong to them), see \ref setSortBatch()
+    void sortRays(std::vector<Ray3f> &rays, std::vector<uint32_t> &paths,
+                  std::vector<Color3f> *values);
+
+    /// Sort the hits by BSDF and shape, see \ref setSortBatch()
+    void sortHits();
+
+    /**
+     * \brief Reorder the elements of a window according to the sorted
+     * keys, whose lower 32 bits hold the previous index of each element
+     */
+    template <typename T> void permute(T *values);
+
+private:
+    /* Path state */
+    std::vector<Point2f> m_pixelSamples;
+    std::vector<Color3f> m_weights;
+    std::vector<Color3f> m_radiance;
+    std::vector<Color3f> m_throughput;
+    std::vector<float> m_pdf;
+    std::vector<Intersection> m_vertex;
+
+    /* Rays that are traced in the next stage */
+    std::vector<Ray3f> m_rays;
+    std::vector<uint32_t> m_paths;
+
+    /* Rays that are being shaded, and their hits */
+    std::vector<Ray3f> m_hitRays;
+    std::vector<uint32_t> m_hitPaths;
+    std::vector<Intersection> m_its;
+    std::unique_ptr<bool[]> m_found;
+
+    /* Shadow rays and the radiance they carry */
+    ShadowQueue m_shadows;
+
+    /* Sorting */
+    size_t m_sortBatch = 0;
+    std::vector<uint64_t> m_keys;
+    std::vector<uint8_t> m_done;
+    std::unordered_map<const void *, uint32_t> m_ranks;
+
+    int m_depth = 0;
+};
+
+NORI_NAMESPACE_END
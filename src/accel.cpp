@@ -17,98 +17,473 @@
 */
 
 #include <nori/accel.h>
-#include <Eigen/Geometry>
+#include <nori/sphereset.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#define NORI_BVH_BINS      16   /* Bins along every axis for evaluating the SAH */
+#define NORI_BVH_MAX_LEAF  8    /* Maximum number of primitives in a leaf */
+#define NORI_BVH_MAX_DEPTH 48   /* Deeper nodes are split at the median */
+#define NORI_BVH_STACK     96   /* Size of the traversal stack */
+#define NORI_BVH_PARALLEL  4096 /* Larger subtrees are built in parallel */
 
 NORI_NAMESPACE_BEGIN
 
-void Accel::addMesh(Mesh *mesh) {
-    if (m_mesh)
-        throw NoriException("Accel: only a single mesh is supported!");
-    m_mesh = mesh;
-    m_bbox = ((Shape*)m_mesh)->getBoundingBox();
+static_assert(sizeof(BoundingBox3f) == 24, "Unexpected bounding box size");
+static_assert(NORI_BVH_MAX_LEAF <= NORI_TRIANGLE_PACK, "A leaf must fit into a triangle pack");
+
+/// Node of the (temporary) pointer-based hierarchy
+struct Accel::BuildNode {
+    BoundingBox3f bbox;
+    std::unique_ptr<BuildNode> children[2];
+    uint32_t start = 0, count = 0;
+    int axis = 0;
+};
+
+/// Bounding boxes and centroids of the primitives, which are sorted via \c indices
+struct Accel::BuildContext {
+    std::vector<BoundingBox3f> bounds;
+    std::vector<Point3f> centroids;
+    std::vector<uint32_t> indices;
+    std::atomic<uint32_t> nodeCount{0};
+    /// Are the primitives tested a pack at a time (see \ref leafCost())?
+    bool packed = false;
+
+    /**
+     * \brief Return the cost of intersecting a leaf relative to traversing a node
+     *
+     * With meshes, the triangles of a leaf are tested together, so the cost
+     * grows with the number of packs instead of the number of primitives.
+     */
+    float leafCost(uint32_t count) const {
+        if (packed)
+            return (float) ((count + NORI_TRIANGLE_PACK - 1) / NORI_TRIANGLE_PACK);
+        return (float) count;
+    }
+};
+
+/// Bounds of the primitives and of their centroids
+struct RangeBounds {
+    BoundingBox3f bbox, centroids;
+
+    void merge(const RangeBounds &other) {
+        bbox.expandBy(other.bbox);
+        centroids.expandBy(other.centroids);
+    }
+};
+
+/// Primitive counts and bounds of the bins along every axis
+struct Bins {
+    BoundingBox3f bbox[3][NORI_BVH_BINS];
+    uint32_t count[3][NORI_BVH_BINS] = { };
+
+    void merge(const Bins &other) {
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int i = 0; i < NORI_BVH_BINS; ++i) {
+                bbox[axis][i].expandBy(other.bbox[axis][i]);
+                count[axis][i] += other.count[axis][i];
+            }
+        }
+    }
+};
+
+/// Return the bin of a centroid along the given axis
+static inline int binIndex(const BoundingBox3f &centroids, const Point3f &c, int axis) {
+    float extent = centroids.max[axis] - centroids.min[axis];
+    int bin = (int) (NORI_BVH_BINS * (c[axis] - centroids.min[axis]) / extent);
+    return std::min(std::max(bin, 0), NORI_BVH_BINS - 1);
+}
+
+/**
+ * \brief Reduce a range of primitives, in parallel if it is large
+ *
+ * \c func adds the primitives of a subrange to a partial result, which
+ * are then combined using their \c merge() function.
+ */
+template <typename Result, typename Func>
+static Result reduceRange(uint32_t start, uint32_t end, const Func &func) {
+    if (end - start < NORI_BVH_PARALLEL) {
+        Result result;
+        func(start, end, result);
+        return result;
+    }
+    return tbb::parallel_reduce(
+        tbb::blocked_range<uint32_t>(start, end, NORI_BVH_PARALLEL / 4), Result(),
+        [&](const tbb::blocked_range<uint32_t> &range, Result result) {
+            func(range.begin(), range.end(), result);
+            return result;
+        },
+        [](Result a, const Result &b) {
+            a.merge(b);
+            return a;
+        }
+    );
+}
+
+/// Slab test of a ray segment against a bounding box
+static inline bool intersectBox(const BoundingBox3f &bbox, const Ray3f &ray) {
+    float nearT = ray.mint, farT = ray.maxt;
+    for (int i = 0; i < 3; ++i) {
+        float t0 = (bbox.min[i] - ray.o[i]) * ray.dRcp[i];
+        float t1 = (bbox.max[i] - ray.o[i]) * ray.dRcp[i];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        nearT = std::max(nearT, t0);
+        farT = std::min(farT, t1);
+        if (nearT > farT)
+            return false;
+    }
+    return true;
+}
+
+void Accel::addShape(Shape *shape) {
+    if (!m_nodes.empty())
+        throw NoriException("Accel: shapes can't be added after the hierarchy has been built!");
+    m_shapes.push_back(ShapeEntry{ shape, dynamic_cast<const Mesh *>(shape),
+                                   dynamic_cast<const SphereSet *>(shape) });
+}
+
+void Accel::clear() {
+    m_nodes.clear();
+    m_nodes.shrink_to_fit();
+    m_primitives.clear();
+    m_primitives.shrink_to_fit();
+    m_packs.clear();
+    m_packs.shrink_to_fit();
 }
 
 void Accel::build() {
-    /* Nothing to do here for now */
+    clear();
+
+    /* The shapes may still have been loading when they were added */
+    m_bbox.reset();
+    for (uint32_t i = 0; i < (uint32_t) m_shapes.size(); ++i) {
+        const ShapeEntry &entry = m_shapes[i];
+        m_bbox.expandBy(entry.shape->getBoundingBox());
+        uint32_t count = 1;
+        if (entry.mesh)
+            count = entry.mesh->getTriangleCount();
+        else if (entry.spheres)
+            count = entry.spheres->getSphereCount();
+        for (uint32_t j = 0; j < count; ++j)
+            m_primitives.push_back(Primitive{ i, j });
+    }
+    if (m_primitives.empty())
+        return;
+
+    uint32_t primCount = (uint32_t) m_primitives.size();
+    BuildContext ctx;
+    for (const ShapeEntry &entry : m_shapes)
+        ctx.packed |= entry.mesh != nullptr;
+    ctx.bounds.resize(primCount);
+    ctx.centroids.resize(primCount);
+    ctx.indices.resize(primCount);
+
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, primCount),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i = range.begin(); i < range.end(); ++i) {
+                const Primitive &prim = m_primitives[i];
+                const ShapeEntry &entry = m_shapes[prim.shape];
+                BoundingBox3f &bbox = ctx.bounds[i];
+                if (entry.mesh) {
+                    bbox = entry.mesh->getBoundingBox(prim.index);
+                } else if (entry.spheres) {
+                    auto sphere = entry.spheres->getSpheres().col(prim.index);
+                    Point3f center = sphere.head<3>();
+                    bbox = BoundingBox3f(center - Vector3f(sphere[3]), center + Vector3f(sphere[3]));
+                } else {
+                    bbox = entry.shape->getBoundingBox();
+                }
+                ctx.centroids[i] = bbox.getCenter();
+                ctx.indices[i] = i;
+            }
+        }
+    );
+
+    std::unique_ptr<BuildNode> root(buildRecursive(ctx, 0, primCount, 0));
+
+    /* Store the primitives in the order of the leaves */
+    std::vector<Primitive> primitives(primCount);
+    for (uint32_t i = 0; i < primCount; ++i)
+        primitives[i] = m_primitives[ctx.indices[i]];
+    m_primitives.swap(primitives);
+
+    m_nodes.reserve(ctx.nodeCount);
+    flatten(root.get());
+    buildPacks();
 }
 
-bool Accel::rayIntersect(const Ray3f &ray_, Intersection &its, bool shadowRay) const {
-    bool foundIntersection = false;  // Was an intersection found so far?
-    uint32_t f = (uint32_t) -1;      // Triangle index of the closest intersection
+void Accel::buildPacks() {
+    bool hasMeshes = false;
+    for (const ShapeEntry &entry : m_shapes)
+        hasMeshes |= entry.mesh != nullptr;
 
-    Ray3f ray(ray_); /// Make a copy of the ray (we will need to update its '.maxt' value)
+    /* Every leaf gets a full pack of primitive slots, so that the index
+       of its triangle pack follows from the index of its first primitive */
+    uint32_t leafCount = 0;
+    for (const Node &node : m_nodes)
+        leafCount += node.count > 0 ? 1 : 0;
+    std::vector<Primitive> primitives(leafCount * NORI_TRIANGLE_PACK,
+                                      Primitive{ (uint32_t) -1, (uint32_t) -1 });
+    if (hasMeshes)
+        m_packs.resize(leafCount);
+
+    uint32_t leaf = 0;
+    for (Node &node : m_nodes) {
+        if (node.count == 0)
+            continue;
 
-    /* Brute force search through all triangles */
-    for (uint32_t idx = 0; idx < m_mesh->getTriangleCount(); ++idx) {
-        float u, v, t;
-        if (m_mesh->rayIntersect(idx, ray, u, v, t)) {
-            /* An intersection was found! Can terminate
-               immediately if this is a shadow ray query */
-            if (shadowRay)
-                return true;
-            ray.maxt = its.t = t;
-            its.uv = Point2f(u, v);
-            its.shape = m_mesh;
-            f = idx;
-            foundIntersection = true;
+        /* Triangles first */
+        Primitive *prims = primitives.data() + leaf * NORI_TRIANGLE_PACK;
+        std::copy(m_primitives.begin() + node.offset,
+                  m_primitives.begin() + node.offset + node.count, prims);
+        Primitive *others = std::stable_partition(prims, prims + node.count,
+            [&](const Primitive &prim) { return m_shapes[prim.shape].mesh != nullptr; });
+        node.offset = leaf * NORI_TRIANGLE_PACK;
+        node.triangles = (uint16_t) (others - prims);
+
+        for (int i = 0; i < node.triangles; ++i) {
+            const Mesh *mesh = m_shapes[prims[i].shape].mesh;
+            const MatrixXf &V = mesh->getVertexPositions();
+            const MatrixXu &F = mesh->getIndices();
+            uint32_t index = prims[i].index;
+            m_packs[leaf].set(i, V.col(F(0, index)), V.col(F(1, index)),
+                              V.col(F(2, index)), index);
         }
+        leaf++;
     }
+    m_primitives.swap(primitives);
+}
+
+Accel::BuildNode *Accel::buildRecursive(BuildContext &ctx, uint32_t start, uint32_t end, int depth) const {
+    BuildNode *node = new BuildNode();
+    ctx.nodeCount++;
+
+    uint32_t *indices = ctx.indices.data();
+    RangeBounds bounds = reduceRange<RangeBounds>(start, end,
+        [&](uint32_t first, uint32_t last, RangeBounds &result) {
+            for (uint32_t i = first; i < last; ++i) {
+                result.bbox.expandBy(ctx.bounds[indices[i]]);
+                result.centroids.expandBy(ctx.centroids[indices[i]]);
+            }
+        });
+    node->bbox = bounds.bbox;
+    node->start = start;
+    node->count = end - start;
+
+    if (node->count == 1)
+        return node;
 
-    if (foundIntersection) {
-        /* At this point, we now know that there is an intersection,
-           and we know the triangle index of the closest such intersection.
-
-           The following computes a number of additional properties which
-           characterize the intersection (normals, texture coordinates, etc..)
-        */
-
-        /* Find the barycentric coordinates */
-        Vector3f bary;
-        bary << 1-its.uv.sum(), its.uv;
-
-        /* References to all relevant mesh buffers */
-		const Mesh *mesh = static_cast<const Mesh *>(its.shape);
-        const MatrixXf &V  = mesh->getVertexPositions();
-        const MatrixXf &N  = mesh->getVertexNormals();
-        const MatrixXf &UV = mesh->getVertexTexCoords();
-        const MatrixXu &F  = mesh->getIndices();
-
-        /* Vertex indices of the triangle */
-        uint32_t idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
-
-        Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
-
-        /* Compute the intersection positon accurately
-           using barycentric coordinates */
-        its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
-
-        /* Compute proper texture coordinates if provided by the mesh */
-        if (UV.size() > 0)
-            its.uv = bary.x() * UV.col(idx0) +
-                bary.y() * UV.col(idx1) +
-                bary.z() * UV.col(idx2);
-
-        /* Compute the geometry frame */
-        its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
-
-        if (N.size() > 0) {
-            /* Compute the shading frame. Note that for simplicity,
-               the current implementation doesn't attempt to provide
-               tangents that are continuous across the surface. That
-               means that this code will need to be modified to be able
-               use anisotropic BRDFs, which need tangent continuity */
-
-            its.shFrame = Frame(
-                (bary.x() * N.col(idx0) +
-                 bary.y() * N.col(idx1) +
-                 bary.z() * N.col(idx2)).normalized());
-        } else {
-            its.shFrame = its.geoFrame;
+    /* Evaluate the SAH after every bin along all axes that the
+       centroids extend along */
+    int bestAxis = -1, bestBin = 0;
+    float bestCost = std::numeric_limits<float>::infinity();
+    Vector3f extents = bounds.centroids.getExtents();
+    if (depth < NORI_BVH_MAX_DEPTH && extents.maxCoeff() > 0) {
+        Bins bins = reduceRange<Bins>(start, end,
+            [&](uint32_t first, uint32_t last, Bins &result) {
+                for (uint32_t i = first; i < last; ++i) {
+                    const Point3f &c = ctx.centroids[indices[i]];
+                    for (int axis = 0; axis < 3; ++axis) {
+                        if (extents[axis] <= 0)
+                            continue;
+                        int bin = binIndex(bounds.centroids, c, axis);
+                        result.bbox[axis][bin].expandBy(ctx.bounds[indices[i]]);
+                        result.count[axis][bin]++;
+                    }
+                }
+            });
+
+        float invArea = 1.0f / node->bbox.getSurfaceArea();
+        for (int axis = 0; axis < 3; ++axis) {
+            if (extents[axis] <= 0)
+                continue;
+
+            /* Sweep from the right to get the cost of the right sides .. */
+            float rightCost[NORI_BVH_BINS];
+            BoundingBox3f bbox;
+            uint32_t count = 0;
+            for (int i = NORI_BVH_BINS - 1; i > 0; --i) {
+                bbox.expandBy(bins.bbox[axis][i]);
+                count += bins.count[axis][i];
+                rightCost[i] = count > 0 ? ctx.leafCost(count) * bbox.getSurfaceArea() : 0.0f;
+            }
+
+            /* .. and then from the left to combine them */
+            bbox.reset();
+            count = 0;
+            for (int i = 0; i < NORI_BVH_BINS - 1; ++i) {
+                bbox.expandBy(bins.bbox[axis][i]);
+                count += bins.count[axis][i];
+                if (count == 0 || count == node->count)
+                    continue;
+                float cost = 1.0f + (ctx.leafCost(count) * bbox.getSurfaceArea() + rightCost[i + 1]) * invArea;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
         }
     }
 
-    return foundIntersection;
+    if (node->count <= NORI_BVH_MAX_LEAF && !(bestCost < ctx.leafCost(node->count)))
+        return node;
+
+    uint32_t *mid;
+    if (bestAxis >= 0) {
+        mid = std::partition(indices + start, indices + end, [&](uint32_t i) {
+            return binIndex(bounds.centroids, ctx.centroids[i], bestAxis) <= bestBin;
+        });
+        node->axis = bestAxis;
+    } else {
+        /* The centroids coincide or the node is too deep: split at the median */
+        int axis = bounds.centroids.getLargestAxis();
+        mid = indices + start + node->count / 2;
+        std::nth_element(indices + start, mid, indices + end, [&](uint32_t a, uint32_t b) {
+            return ctx.centroids[a][axis] < ctx.centroids[b][axis];
+        });
+        node->axis = axis;
+    }
+    uint32_t split = (uint32_t) (mid - indices);
+
+    if (node->count > NORI_BVH_PARALLEL) {
+        tbb::parallel_invoke(
+            [&] { node->children[0].reset(buildRecursive(ctx, start, split, depth + 1)); },
+            [&] { node->children[1].reset(buildRecursive(ctx, split, end, depth + 1)); }
+        );
+    } else {
+        node->children[0].reset(buildRecursive(ctx, start, split, depth + 1));
+        node->children[1].reset(buildRecursive(ctx, split, end, depth + 1));
+    }
+    node->count = 0;
+    return node;
 }
 
-NORI_NAMESPACE_END
+uint32_t Accel::flatten(const BuildNode *node) {
+    uint32_t index = (uint32_t) m_nodes.size();
+    m_nodes.emplace_back();
+
+    Node result;
+    result.bbox = node->bbox;
+    result.axis = (uint16_t) node->axis;
+    if (node->count > 0) {
+        result.offset = node->start;
+        result.count = (uint16_t) node->count;
+    } else {
+        /* The first child directly follows its parent */
+        flatten(node->children[0].get());
+        result.offset = flatten(node->children[1].get());
+        result.count = 0;
+    }
+    m_nodes[index] = result;
+    return index;
+}
+
+bool Accel::intersectPrimitive(const Primitive &prim, const Ray3f &ray, float &t, RTCHit &hit) const {
+    const ShapeEntry &entry = m_shapes[prim.shape];
+    if (entry.mesh) {
+        float u, v;
+        if (!entry.mesh->rayIntersect(prim.index, ray, u, v, t))
+            return false;
+        hit.u = u;
+        hit.v = v;
+    } else if (entry.spheres) {
+        if (!entry.spheres->rayIntersect(prim.index, ray, t))
+            return false;
+    } else {
+        Normal3f normal;
+        Vector2f uv;
+        if (!entry.shape->rayIntersect(ray, t, normal, uv))
+            return false;
+        hit.u = uv.x();
+        hit.v = uv.y();
+        hit.Ng_x = normal.x();
+        hit.Ng_y = normal.y();
+        hit.Ng_z = normal.z();
+    }
+    hit.primID = prim.index;
+    hit.geomID = prim.shape;
+    hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    return true;
+}
+
+bool Accel::rayIntersect(const Ray3f &ray_, Intersection &its, bool shadowRay) const {
+    if (m_nodes.empty())
+        return false;
+
+    Ray3f ray(ray_); /// Make a copy of the ray (we will need to update its '.maxt' value)
+
+    const Primitive *closest = nullptr; // Primitive of the closest intersection
+    RTCHit hit, closestHit;
+
+    /* Visit the child on the near side first */
+    bool dirIsNeg[3] = { ray.dRcp.x() < 0, ray.dRcp.y() < 0, ray.dRcp.z() < 0 };
+    uint32_t stack[NORI_BVH_STACK];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const Node &node = m_nodes[nodeIndex];
+        if (intersectBox(node.bbox, ray)) {
+            if (node.count == 0) {
+                if (dirIsNeg[node.axis]) {
+                    stack[stackSize++] = nodeIndex + 1;
+                    nodeIndex = node.offset;
+                } else {
+                    stack[stackSize++] = node.offset;
+                    nodeIndex = nodeIndex + 1;
+                }
+                continue;
+            }
 
+            if (node.triangles > 0) {
+                float t, u, v;
+                int slot = m_packs[node.offset / NORI_TRIANGLE_PACK].rayIntersect(ray, t, u, v);
+                if (slot >= 0) {
+                    if (shadowRay)
+                        return true;
+                    ray.maxt = t;
+                    closest = &m_primitives[node.offset + slot];
+                    closestHit.u = u;
+                    closestHit.v = v;
+                    closestHit.primID = closest->index;
+                    closestHit.geomID = closest->shape;
+                    closestHit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+                }
+            }
+
+            for (uint32_t i = node.offset + node.triangles; i < node.offset + node.count; ++i) {
+                float t;
+                if (intersectPrimitive(m_primitives[i], ray, t, hit)) {
+                    /* An intersection was found! Can terminate
+                       immediately if this is a shadow ray query */
+                    if (shadowRay)
+                        return true;
+                    ray.maxt = t;
+                    closest = &m_primitives[i];
+                    closestHit = hit;
+                }
+            }
+        }
+        if (stackSize == 0)
+            break;
+        nodeIndex = stack[--stackSize];
+    }
+
+    if (!closest)
+        return false;
+
+    /* The shape computes the remaining properties of the intersection
+       (position, normals, texture coordinates, etc..) */
+    m_shapes[closest->shape].shape->setHitInformation(ray_, ray.maxt, closestHit, its);
+    its.instance = nullptr;
+    return true;
+}
+
+NORI_NAMESPACE_END
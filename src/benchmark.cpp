@@ -0,0 +1,523 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/benchmark.h>
+#include <nori/block.h>
+#include <nori/rfilter.h>
+#include <nori/timer.h>
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/integrator.h>
+#include <nori/render.h>
+#include <nori/numa.h>
+#include <nori/stats.h>
+#include <nori/mesh.h>
+#include <nori/trianglepack.h>
+#include <filesystem/resolver.h>
+#include <pcg32.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/global_control.h>
+#include <memory>
+#include <thread>
+
+NORI_NAMESPACE_BEGIN
+
+std::vector<int> benchmarkThreadCounts(int maxThreads) {
+    /* A thread limit that is active (--threads) caps the sweep, since
+       TBB always uses the smallest limit */
+    maxThreads = maxThreads > 0 ? std::min(maxThreads, getThreadCount()) : getThreadCount();
+    std::vector<int> result;
+    for (int n = 1; n < maxThreads; n *= 2)
+        result.push_back(n);
+    result.push_back(maxThreads);
+    return result;
+}
+
+/**
+ * Measures how many finished blocks per second can be merged into a
+ * full-HD image, depending on the number of threads. The band-locked
+ * merge is compared against a single lock around the entire image.
+ */
+static int benchmarkFilm(const std::vector<std::string> &args) {
+    int blockSize = args.size() > 0 ? toInt(args[0]) : NORI_BLOCK_SIZE;
+    if (blockSize < 1)
+        throw NoriException("The block size must be positive!");
+
+    const Vector2i size(1920, 1080);
+    const int rounds = 20;
+
+    std::unique_ptr<ReconstructionFilter> filter(static_cast<ReconstructionFilter *>(
+        NoriObjectFactory::createInstance("gaussian", PropertyList())));
+    ImageBlock film(size, filter.get());
+    BlockGenerator blockGenerator(size, blockSize);
+    int blockCount = blockGenerator.getBlockCount();
+
+    /* Precompute the block layout, since the generator itself is
+       a point of contention that shouldn't be measured here */
+    std::vector<std::pair<Point2i, Vector2i>> blocks;
+    {
+        ImageBlock block(Vector2i::Constant(blockSize), filter.get());
+        while (blockGenerator.next(block))
+            blocks.push_back(std::make_pair(block.getOffset(), block.getSize()));
+    }
+
+    /* Every merge adds a weight of one to all pixels of a block */
+    double expectedWeight = 0;
+    for (auto &b : blocks)
+        expectedWeight += (double) (b.second + Vector2i::Constant(2*film.getBorderSize())).prod();
+    expectedWeight *= rounds;
+
+    cout << tfm::format("Merging %i blocks of %ix%i pixels into a %ix%i image, %i rounds",
+        blockCount, blockSize, blockSize, size.x(), size.y(), rounds) << endl << endl;
+    cout << "threads   band locks (blocks/s)   global lock (blocks/s)   speedup" << endl;
+
+    for (int threads : benchmarkThreadCounts()) {
+        tbb::global_control limit(tbb::global_control::max_allowed_parallelism, (size_t) threads);
+        double throughput[2];
+
+        for (int variant = 0; variant < 2; ++variant) {
+            bool globalLock = variant == 1;
+            tbb::mutex globalMutex;
+            film.clear();
+
+            Timer timer;
+            tbb::parallel_for(tbb::blocked_range<int>(0, blockCount * rounds),
+                [&](const tbb::blocked_range<int> &range) {
+                    ImageBlock block(Vector2i::Constant(blockSize), filter.get());
+                    block.setConstant(Color4f(1.f, 1.f, 1.f, 1.f));
+                    for (int i = range.begin(); i < range.end(); ++i) {
+                        block.setOffset(blocks[i % blockCount].first);
+                        block.setSize(blocks[i % blockCount].second);
+                        if (globalLock) {
+                            tbb::mutex::scoped_lock lock(globalMutex);
+                            film.put(block);
+                        } else {
+                            film.put(block);
+                        }
+                    }
+                }
+            );
+            throughput[variant] = blockCount * rounds / (timer.elapsed() * 1e-3);
+
+            double weight = 0;
+            for (int y = 0; y < film.rows(); ++y)
+                for (int x = 0; x < film.cols(); ++x)
+                    weight += film.coeff(y, x).w();
+            if (weight != expectedWeight)
+                throw NoriException("Film merge produced a total weight of %f (expected %f)!",
+                    weight, expectedWeight);
+        }
+
+        cout << tfm::format("%7i   %21.0f   %22.0f   %6.2fx", threads,
+            throughput[0], throughput[1], throughput[0] / throughput[1]) << endl;
+    }
+    return 0;
+}
+
+/**
+ * \brief Parse the common arguments of the scene benchmarks
+ *
+ * These are <tt>[--time seconds] scene.xml [scene2.xml ..]</tt>
+ */
+static std::vector<std::string> parseSceneArgs(const std::vector<std::string> &args,
+                                               float &timeBudget) {
+    std::vector<std::string> scenes;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--time" && i + 1 < args.size())
+            timeBudget = toFloat(args[++i]);
+        else
+            scenes.push_back(args[i]);
+    }
+    if (scenes.empty())
+        throw NoriException("Expected at least one scene file!");
+    if (timeBudget <= 0)
+        throw NoriException("The time budget must be positive!");
+    return scenes;
+}
+
+/**
+ * \brief Load a scene for benchmarking purposes
+ *
+ * \param numa
+ *     Interleave the scene data across the NUMA nodes (see \ref RenderOptions::numa)
+ */
+static std::unique_ptr<Scene> loadBenchmarkScene(const std::string &filename, bool numa = false) {
+    filesystem::path path(filename);
+    getFileResolver()->prepend(path.parent_path());
+    if (numa)
+        setInterleavedAllocation(true);
+    std::unique_ptr<NoriObject> root(loadFromXML(filename));
+    if (numa)
+        setInterleavedAllocation(false);
+    if (root->getClassType() != NoriObject::EScene)
+        throw NoriException("\"%s\" does not contain a scene!", filename);
+    return std::unique_ptr<Scene>(static_cast<Scene *>(root.release()));
+}
+
+/**
+ * \brief Render a scene without any output and return the achieved
+ * throughput in millions of rays per second
+ *
+ * \param time
+ *     If given, the time it took to render the scene in milliseconds
+ */
+static double benchmarkRender(Scene *scene, const std::string &filename,
+                              RenderOptions options, double *time = nullptr) {
+    options.quiet = true;
+    options.writeOutput = false;
+
+    uint64_t raysBefore = Statistics::instance().rays.value();
+    Timer timer;
+    render(scene, filename, options);
+    double elapsed = timer.elapsed();
+    if (time)
+        *time = elapsed;
+    return (Statistics::instance().rays.value() - raysBefore) / (elapsed * 1e3);
+}
+
+/**
+ * Measures the ray throughput for every combination of block order
+ * and pixel order. Each configuration renders progressive passes for a
+ * fixed amount of time.
+ */
+static int benchmarkOrder(const std::vector<std::string> &args) {
+    float timeBudget = 10;
+    std::vector<std::string> scenes = parseSceneArgs(args, timeBudget);
+    const ETraversalOrder blockOrders[] = { ESpiralOrder, EScanlineOrder, EMortonOrder, EHilbertOrder };
+    const ETraversalOrder pixelOrders[] = { EScanlineOrder, EMortonOrder };
+
+    for (const std::string &filename : scenes) {
+        std::unique_ptr<Scene> scene = loadBenchmarkScene(filename);
+
+        cout << endl << tfm::format("%s (%.0fs per configuration)", filename, timeBudget) << endl;
+        cout << "block order   Mrays/s (scanline pixels)   Mrays/s (morton pixels)" << endl;
+        for (ETraversalOrder blockOrder : blockOrders) {
+            double raysPerSec[2];
+            for (int i = 0; i < 2; ++i) {
+                RenderOptions options;
+                options.timeBudget = timeBudget;
+                options.blockOrder = toString(blockOrder);
+                options.pixelOrder = toString(pixelOrders[i]);
+                raysPerSec[i] = benchmarkRender(scene.get(), filename, options);
+            }
+            cout << tfm::format("%-11s   %23.2f   %23.2f", toString(blockOrder),
+                raysPerSec[0], raysPerSec[1]) << endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compares the ray throughput of the default scheduler with NUMA mode,
+ * where the scene data is interleaved across the nodes and every node
+ * renders its own part of the image.
+ */
+static int benchmarkNuma(const std::vector<std::string> &args) {
+    float timeBudget = 10;
+    std::vector<std::string> scenes = parseSceneArgs(args, timeBudget);
+
+    std::vector<std::vector<int>> nodes = getNumaNodes();
+    cout << nodes.size() << " NUMA node(s) with";
+    for (auto &cpus : nodes)
+        cout << " " << cpus.size();
+    cout << " cores" << endl;
+
+    for (const std::string &filename : scenes) {
+        double raysPerSec[2];
+        for (int numa = 0; numa < 2; ++numa) {
+            std::unique_ptr<Scene> scene = loadBenchmarkScene(filename, numa == 1);
+            RenderOptions options;
+            options.timeBudget = timeBudget;
+            options.numa = numa == 1;
+            raysPerSec[numa] = benchmarkRender(scene.get(), filename, options);
+        }
+        cout << endl << tfm::format("%s (%.0fs per configuration)", filename, timeBudget) << endl;
+        cout << "default (Mrays/s)   NUMA (Mrays/s)   speedup" << endl;
+        cout << tfm::format("%17.2f   %14.2f   %6.2fx", raysPerSec[0], raysPerSec[1],
+            raysPerSec[1] / raysPerSec[0]) << endl;
+    }
+    return 0;
+}
+
+/**
+ * Measures the ray throughput of the wavefront engine when its rays and
+ * hits are sorted in windows of different sizes (see \ref Wavefront::setSortBatch())
+ */
+static int benchmarkReorder(const std::vector<std::string> &args) {
+    float timeBudget = 10;
+    std::vector<std::string> scenes = parseSceneArgs(args, timeBudget);
+    const int sortBatches[] = { 0, 256, 1024, 4096 };
+
+    for (const std::string &filename : scenes) {
+        std::unique_ptr<Scene> scene = loadBenchmarkScene(filename);
+        if (!scene->getIntegrator()->supportsWavefront())
+            throw NoriException("The integrator of \"%s\" doesn't support the wavefront engine!", filename);
+
+        cout << endl << tfm::format("%s (%.0fs per configuration)", filename, timeBudget) << endl;
+        cout << "sort batch   Mrays/s   speedup" << endl;
+        double unsorted = 0;
+        for (int sortBatch : sortBatches) {
+            RenderOptions options;
+            options.timeBudget = timeBudget;
+            options.wavefront = true;
+            options.sortBatch = sortBatch;
+            double raysPerSec = benchmarkRender(scene.get(), filename, options);
+            if (sortBatch == 0)
+                unsorted = raysPerSec;
+            cout << tfm::format("%10s   %7.2f   %6.2fx", sortBatch == 0 ? "none" : std::to_string(sortBatch),
+                raysPerSec, raysPerSec / unsorted) << endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Measures how the construction of a scene (loading it and building the
+ * acceleration data structure) and the ray throughput scale with the
+ * number of threads. The parallel efficiency is the speedup relative to
+ * a single thread divided by the number of threads.
+ */
+static int benchmarkScaling(const std::vector<std::string> &args) {
+    float timeBudget = 10;
+    int maxThreads = 0;
+    std::vector<std::string> sceneArgs;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--max-threads" && i + 1 < args.size())
+            maxThreads = toInt(args[++i]);
+        else
+            sceneArgs.push_back(args[i]);
+    }
+    std::vector<std::string> scenes = parseSceneArgs(sceneArgs, timeBudget);
+
+    for (const std::string &filename : scenes) {
+        cout << endl << tfm::format("%s (%.0fs per configuration)", filename, timeBudget) << endl;
+        cout << "threads   construction   efficiency   Mrays/s   efficiency" << endl;
+
+        double baseLoadTime = 0, baseRaysPerSec = 0;
+        for (int threads : benchmarkThreadCounts(maxThreads)) {
+            tbb::global_control limit(tbb::global_control::max_allowed_parallelism, (size_t) threads);
+
+            Timer timer;
+            std::unique_ptr<Scene> scene = loadBenchmarkScene(filename);
+            double loadTime = timer.elapsed();
+
+            RenderOptions options;
+            options.timeBudget = timeBudget;
+            double raysPerSec = benchmarkRender(scene.get(), filename, options);
+
+            if (threads == 1) {
+                baseLoadTime = loadTime;
+                baseRaysPerSec = raysPerSec;
+            }
+            cout << tfm::format("%7i   %12s   %9.1f%%   %7.2f   %9.1f%%", threads,
+                timeString(loadTime), 100 * baseLoadTime / (loadTime * threads),
+                raysPerSec, 100 * raysPerSec / (baseRaysPerSec * threads)) << endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compares the Embree build settings (see \ref Scene::setBuildOptions()):
+ * the time it takes to build the BVH and its memory usage against the
+ * time it takes to render the scene with the sample count of its sampler.
+ * Fast builds pay off for previews, high-quality builds for long renders.
+ */
+static int benchmarkBuild(const std::vector<std::string> &args) {
+    if (args.empty())
+        throw NoriException("Expected at least one scene file!");
+    const std::pair<const char *, const char *> settings[] = {
+        { "robust", "low" }, { "robust", "medium" }, { "robust", "high" },
+        { "robust", "refit" }, { "robust,compact", "medium" }, { "dynamic", "low" }
+    };
+
+    for (const std::string &filename : args) {
+        std::unique_ptr<Scene> scene = loadBenchmarkScene(filename);
+
+        cout << endl << filename << endl;
+        cout << "flags            quality   build time   BVH memory   render time   Mrays/s   total time" << endl;
+        for (auto &setting : settings) {
+            scene->setBuildOptions(setting.first, setting.second);
+            double renderTime;
+            double raysPerSec = benchmarkRender(scene.get(), filename, RenderOptions(), &renderTime);
+            cout << tfm::format("%-14s   %-7s   %10s   %10s   %11s   %7.2f   %10s", setting.first,
+                setting.second, timeString(scene->getBuildTime()), memString(scene->getBuildMemory()),
+                timeString(renderTime), raysPerSec, timeString(scene->getBuildTime() + renderTime)) << endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compares Embree with the BVH of \ref Accel: the time it takes to build
+ * them, their memory usage and the ray throughput when rendering
+ * progressive passes for a fixed amount of time.
+ */
+static int benchmarkAccel(const std::vector<std::string> &args) {
+    float timeBudget = 10;
+    std::vector<std::string> scenes = parseSceneArgs(args, timeBudget);
+    const char *accels[] = { "embree", "bvh" };
+
+    for (const std::string &filename : scenes) {
+        std::unique_ptr<Scene> scene = loadBenchmarkScene(filename);
+
+        cout << endl << tfm::format("%s (%.0fs per configuration)", filename, timeBudget) << endl;
+        cout << "accel    build time   BVH memory   Mrays/s" << endl;
+        for (const char *accel : accels) {
+            scene->setAccel(accel);
+            RenderOptions options;
+            options.timeBudget = timeBudget;
+            double raysPerSec = benchmarkRender(scene.get(), filename, options);
+            cout << tfm::format("%-6s   %10s   %10s   %7.2f", accel, timeString(scene->getBuildTime()),
+                memString(scene->getBuildMemory()), raysPerSec) << endl;
+        }
+    }
+    return 0;
+}
+
+/// Mesh with randomly placed triangles in the unit cube
+class BenchmarkMesh : public Mesh {
+public:
+    BenchmarkMesh(uint32_t count, pcg32 &rng) : Mesh(PropertyList()) {
+        m_V.resize(3, 3 * count);
+        m_F.resize(3, count);
+        for (uint32_t i = 0; i < count; ++i) {
+            Point3f center(rng.nextFloat(), rng.nextFloat(), rng.nextFloat());
+            for (uint32_t j = 0; j < 3; ++j) {
+                m_V.col(3*i + j) = center + 0.2f * Vector3f(rng.nextFloat() - 0.5f,
+                    rng.nextFloat() - 0.5f, rng.nextFloat() - 0.5f);
+                m_F(j, i) = 3*i + j;
+            }
+        }
+    }
+};
+
+/**
+ * Measures how many ray-triangle tests per second are performed by
+ * \ref Mesh::rayIntersect() and by a \ref TrianglePack, which tests the
+ * triangles of a BVH leaf at once. Both must find the same nearest hits.
+ */
+static int benchmarkTriangles(const std::vector<std::string> &args) {
+    uint32_t triangleCount = args.size() > 0 ? (uint32_t) toInt(args[0]) : 1 << 16;
+    if (triangleCount < NORI_TRIANGLE_PACK)
+        throw NoriException("At least %i triangles are needed!", NORI_TRIANGLE_PACK);
+    triangleCount -= triangleCount % NORI_TRIANGLE_PACK;
+    /* About 2^26 tests per kernel, so that the timings are meaningful */
+    int rayCount = (int) std::max((uint32_t) 256, (1u << 26) / triangleCount);
+
+    pcg32 rng;
+    BenchmarkMesh mesh(triangleCount, rng);
+    std::vector<TrianglePack> packs(triangleCount / NORI_TRIANGLE_PACK);
+    for (uint32_t i = 0; i < triangleCount; ++i) {
+        const MatrixXf &V = mesh.getVertexPositions();
+        const MatrixXu &F = mesh.getIndices();
+        packs[i / NORI_TRIANGLE_PACK].set(i % NORI_TRIANGLE_PACK,
+            V.col(F(0, i)), V.col(F(1, i)), V.col(F(2, i)), i);
+    }
+
+    /* Rays from the outside through the unit cube */
+    std::vector<Ray3f> rays(rayCount);
+    for (Ray3f &ray : rays) {
+        Point3f target(rng.nextFloat(), rng.nextFloat(), rng.nextFloat());
+        ray = Ray3f(Point3f(-1.0f, 0.5f, 0.5f), target - Point3f(-1.0f, 0.5f, 0.5f));
+    }
+
+    /* Nearest hit of every ray (or -1) */
+    std::vector<int64_t> scalarHits(rayCount, -1), packHits(rayCount, -1);
+
+    Timer timer;
+    for (int r = 0; r < rayCount; ++r) {
+        Ray3f ray(rays[r]);
+        for (uint32_t i = 0; i < triangleCount; ++i) {
+            float u, v, t;
+            if (mesh.rayIntersect(i, ray, u, v, t)) {
+                ray.maxt = t;
+                scalarHits[r] = i;
+            }
+        }
+    }
+    double scalarTime = timer.lap();
+
+    for (int r = 0; r < rayCount; ++r) {
+        Ray3f ray(rays[r]);
+        for (const TrianglePack &pack : packs) {
+            float u, v, t;
+            int slot = pack.rayIntersect(ray, t, u, v);
+            if (slot >= 0) {
+                ray.maxt = t;
+                packHits[r] = pack.id[slot];
+            }
+        }
+    }
+    double packTime = timer.elapsed();
+
+    int mismatches = 0;
+    for (int r = 0; r < rayCount; ++r) {
+        if (scalarHits[r] != packHits[r])
+            ++mismatches;
+    }
+
+    double tests = (double) rayCount * triangleCount;
+    cout << tfm::format("%i rays against %i triangles (%i-wide packs)", rayCount,
+        triangleCount, NORI_TRIANGLE_PACK) << endl;
+    cout << "kernel   time         Mtests/s" << endl;
+    cout << tfm::format("scalar   %10s   %8.2f", timeString(scalarTime),
+        tests / (1000 * std::max(scalarTime, 1e-3))) << endl;
+    cout << tfm::format("packs    %10s   %8.2f", timeString(packTime),
+        tests / (1000 * std::max(packTime, 1e-3))) << endl;
+    if (mismatches > 0) {
+        cerr << tfm::format("%i of %i rays found a different nearest hit!", mismatches, rayCount) << endl;
+        return -1;
+    }
+    return 0;
+}
+
+struct Benchmark {
+    const char *name;
+    const char *args;
+    const char *description;
+    int (*run)(const std::vector<std::string> &args);
+};
+
+static const Benchmark benchmarks[] = {
+    { "film",  "[blockSize]", "Merge throughput of finished blocks vs. thread count", benchmarkFilm },
+    { "order", "[--time s] scene.xml ..", "Ray throughput of the block and pixel orders", benchmarkOrder },
+    { "numa",  "[--time s] scene.xml ..", "Ray throughput of NUMA mode vs. the default scheduler", benchmarkNuma },
+    { "reorder", "[--time s] scene.xml ..", "Ray throughput of the wavefront engine vs. the ray sort batch size", benchmarkReorder },
+    { "scaling", "[--time s] [--max-threads n] scene.xml ..", "Scene construction time and ray throughput vs. thread count", benchmarkScaling },
+    { "build", "scene.xml ..", "BVH build time, memory and render time vs. the Embree build settings", benchmarkBuild },
+    { "accel", "[--time s] scene.xml ..", "BVH build time, memory and ray throughput of Embree vs. Nori's BVH", benchmarkAccel },
+    { "triangles", "[count]", "Ray-triangle tests per second of a mesh vs. the packs of Nori's BVH", benchmarkTriangles }
+};
+
+int runBenchmark(const std::string &name, const std::vector<std::string> &args) {
+    for (const Benchmark &b : benchmarks) {
+        if (name == b.name)
+            return b.run(args);
+    }
+
+    if (name != "list")
+        cerr << "Unknown benchmark \"" << name << "\"" << endl;
+    cerr << "Available benchmarks:" << endl;
+    for (const Benchmark &b : benchmarks)
+        cerr << tfm::format("   %-8s %-26s %s", b.name, b.args, b.description) << endl;
+    return name == "list" ? 0 : -1;
+}
+
+NORI_NAMESPACE_END
@@ -81,6 +81,8 @@ void Bitmap::save(const std::string &filename) {
 
     Imf::Header header((int) cols(), (int) rows());
     header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    for (auto &attr : m_metadata)
+        header.insert(attr.first.c_str(), Imf::StringAttribute(attr.second));
 
     Imf::ChannelList &channels = header.channels();
     channels.insert("R", Imf::Channel(Imf::FLOAT));
@@ -21,6 +21,9 @@
 #include <nori/rfilter.h>
 #include <nori/bbox.h>
 #include <tbb/tbb.h>
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfStringAttribute.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -46,6 +49,10 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
 
     /* Allocate space for pixels and border regions */
     resize(size.y() + 2*m_borderSize, size.x() + 2*m_borderSize);
+
+    /* One lock per band of rows */
+    std::vector<Band, tbb::cache_aligned_allocator<Band>>(
+        (rows() + NORI_BAND_SIZE - 1) / NORI_BAND_SIZE).swap(m_bands);
 }
 
 ImageBlock::~ImageBlock() {
@@ -54,6 +61,37 @@ ImageBlock::~ImageBlock() {
     delete[] m_weightsY;
 }
 
+void ImageBlock::clear() {
+    setConstant(Color4f());
+    std::fill(m_stats.begin(), m_stats.end(), PixelStatistics());
+}
+
+void ImageBlock::enableStatistics() {
+    /* Samples are attributed to the pixel that contains them, hence
+       no statistics are needed for the border region */
+    m_statsStride = (int) cols() - 2*m_borderSize;
+    m_stats.assign(m_statsStride * ((int) rows() - 2*m_borderSize), PixelStatistics());
+}
+
+void ImageBlock::write(std::ostream &os) const {
+    int32_t header[4] = { (int32_t) rows(), (int32_t) cols(), m_borderSize, (int32_t) m_stats.size() };
+    os.write((const char *) header, sizeof(header));
+    os.write((const char *) data(), sizeof(Color4f) * size());
+    os.write((const char *) m_stats.data(), sizeof(PixelStatistics) * m_stats.size());
+}
+
+void ImageBlock::read(std::istream &is) {
+    int32_t header[4];
+    is.read((char *) header, sizeof(header));
+    if (!is || header[0] != rows() || header[1] != cols() ||
+        header[2] != m_borderSize || header[3] != (int32_t) m_stats.size())
+        throw NoriException("ImageBlock::read(): incompatible block dimensions!");
+    is.read((char *) data(), sizeof(Color4f) * size());
+    is.read((char *) m_stats.data(), sizeof(PixelStatistics) * m_stats.size());
+    if (!is)
+        throw NoriException("ImageBlock::read(): unexpected end of stream!");
+}
+
 Bitmap *ImageBlock::toBitmap() const {
     Bitmap *result = new Bitmap(m_size);
     for (int y=0; y<m_size.y(); ++y)
@@ -71,6 +109,40 @@ void ImageBlock::fromBitmap(const Bitmap &bitmap) {
             coeffRef(y, x) << bitmap.coeff(y, x), 1;
 }
 
+void ImageBlock::saveWeighted(const std::string &filename,
+                              const std::map<std::string, std::string> &metadata) const {
+    cout << "Writing a " << m_size.x() << "x" << m_size.y()
+         << " weighted OpenEXR file to \"" << filename << "\"" << endl;
+
+    Imf::Header header(m_size.x(), m_size.y());
+    header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    for (auto &attr : metadata)
+        header.insert(attr.first.c_str(), Imf::StringAttribute(attr.second));
+
+    Imf::ChannelList &channels = header.channels();
+    const char *names[] = { "R", "G", "B", "W" };
+    for (const char *name : names)
+        channels.insert(name, Imf::Channel(Imf::FLOAT));
+
+    /* Color4f stores the weight in the last component, so the
+       pixels can be written directly without the border region */
+    size_t compStride = sizeof(float),
+           pixelStride = sizeof(Color4f),
+           rowStride = pixelStride * cols();
+    char *ptr = reinterpret_cast<char *>(const_cast<Color4f *>(
+        data() + m_borderSize * cols() + m_borderSize));
+
+    Imf::FrameBuffer frameBuffer;
+    for (const char *name : names) {
+        frameBuffer.insert(name, Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+        ptr += compStride;
+    }
+
+    Imf::OutputFile file(filename.c_str(), header);
+    file.setFrameBuffer(frameBuffer);
+    file.writePixels(m_size.y());
+}
+
 void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
     if (!value.isValid()) {
         /* If this happens, go fix your code instead of removing this warning ;) */
@@ -78,6 +150,13 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
         return;
     }
 
+    if (!m_stats.empty()) {
+        int x = (int) std::floor(_pos.x()) - m_offset.x(),
+            y = (int) std::floor(_pos.y()) - m_offset.y();
+        if (x >= 0 && y >= 0 && x < m_size.x() && y < m_size.y())
+            m_stats[y * m_statsStride + x].put(value.getLuminance());
+    }
+
     /* Convert to pixel coordinates within the image block */
     Point2f pos(
         _pos.x() - 0.5f - (m_offset.x() - m_borderSize),
@@ -106,11 +185,43 @@ void ImageBlock::put(ImageBlock &b) {
     Vector2i offset = b.getOffset() - m_offset +
         Vector2i::Constant(m_borderSize - b.getBorderSize());
     Vector2i size   = b.getSize()   + Vector2i(2*b.getBorderSize());
+    Vector2i statsOffset = b.getOffset() - m_offset;
+    bool stats = !m_stats.empty() && b.hasStatistics();
+
+    /* Merge band by band. Only one lock is held at any time, so
+       threads merging neighboring blocks proceed in lockstep
+       rather than waiting for the entire block */
+    for (int y0 = offset.y(); y0 < offset.y() + size.y(); ) {
+        int band = y0 / NORI_BAND_SIZE;
+        int y1 = std::min(offset.y() + size.y(), (band + 1) * NORI_BAND_SIZE);
+
+        tbb::mutex::scoped_lock lock(m_bands[band].mutex);
+
+        block(y0, offset.x(), y1 - y0, size.x())
+            += b.block(y0 - offset.y(), 0, y1 - y0, size.x());
 
-    tbb::mutex::scoped_lock lock(m_mutex);
+        if (stats) {
+            /* Statistics don't have a border region */
+            int sy0 = std::max(y0 - m_borderSize - statsOffset.y(), 0),
+                sy1 = std::min(y1 - m_borderSize - statsOffset.y(), b.getSize().y());
+            for (int y=sy0; y<sy1; ++y)
+                for (int x=0; x<b.getSize().x(); ++x)
+                    m_stats[(y + statsOffset.y()) * m_statsStride + x + statsOffset.x()]
+                        += b.getStatistics(x, y);
+        }
+
+        y0 = y1;
+    }
+}
 
-    block(offset.y(), offset.x(), size.y(), size.x()) 
-        += b.topLeftCorner(size.y(), size.x());
+void ImageBlock::lock() const {
+    for (auto &band : m_bands)
+        band.mutex.lock();
+}
+
+void ImageBlock::unlock() const {
+    for (auto it = m_bands.rbegin(); it != m_bands.rend(); ++it)
+        it->mutex.unlock();
 }
 
 std::string ImageBlock::toString() const {
@@ -118,48 +229,142 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
-BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
-    m_numBlocks = Vector2i(
+ETraversalOrder toTraversalOrder(const std::string &name) {
+    if (name == "scanline")
+        return EScanlineOrder;
+    else if (name == "spiral")
+        return ESpiralOrder;
+    else if (name == "morton")
+        return EMortonOrder;
+    else if (name == "hilbert")
+        return EHilbertOrder;
+    throw NoriException("Unknown traversal order \"%s\" (expected "
+        "\"scanline\", \"spiral\", \"morton\" or \"hilbert\")", name);
+}
+
+std::string toString(ETraversalOrder order) {
+    switch (order) {
+        case EScanlineOrder: return "scanline";
+        case ESpiralOrder:   return "spiral";
+        case EMortonOrder:   return "morton";
+        case EHilbertOrder:  return "hilbert";
+        default:             return "unknown";
+    }
+}
+
+/// Map an index along the Hilbert curve of an n x n grid to a cell (n must be a power of two)
+static Point2i hilbertCell(int n, int d) {
+    Point2i p(0, 0);
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2), ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1)
+                p = Point2i(s - 1 - p.x(), s - 1 - p.y());
+            p = Point2i(p.y(), p.x());
+        }
+        p += Point2i(s * rx, s * ry);
+        d /= 4;
+    }
+    return p;
+}
+
+/// Map an index along the Morton curve to a cell by de-interleaving its bits
+static Point2i mortonCell(uint32_t d) {
+    uint32_t x = 0, y = 0;
+    for (int bit = 0; bit < 16; ++bit) {
+        x |= ((d >> (2*bit))     & 1) << bit;
+        y |= ((d >> (2*bit + 1)) & 1) << bit;
+    }
+    return Point2i((int) x, (int) y);
+}
+
+std::vector<Point2i> traverseGrid(const Vector2i &size, ETraversalOrder order) {
+    std::vector<Point2i> result;
+    result.reserve((size_t) size.prod());
+    auto inside = [&](const Point2i &p) {
+        return (p.array() >= 0).all() && (p.array() < size.array()).all();
+    };
+
+    switch (order) {
+        case EScanlineOrder:
+            for (int y=0; y<size.y(); ++y)
+                for (int x=0; x<size.x(); ++x)
+                    result.push_back(Point2i(x, y));
+            break;
+
+        case ESpiralOrder: {
+                enum EDirection { ERight = 0, EDown, ELeft, EUp };
+                Point2i p(size / 2);
+                int direction = ERight, numSteps = 1, stepsLeft = 1;
+                while (result.size() < (size_t) size.prod()) {
+                    if (inside(p))
+                        result.push_back(p);
+
+                    switch (direction) {
+                        case ERight: ++p.x(); break;
+                        case EDown:  ++p.y(); break;
+                        case ELeft:  --p.x(); break;
+                        case EUp:    --p.y(); break;
+                    }
+
+                    if (--stepsLeft == 0) {
+                        direction = (direction + 1) % 4;
+                        if (direction == ELeft || direction == ERight)
+                            ++numSteps;
+                        stepsLeft = numSteps;
+                    }
+                }
+            }
+            break;
+
+        case EMortonOrder:
+        case EHilbertOrder: {
+                /* Walk the curve over the enclosing power-of-two
+                   square and skip the cells outside of the grid */
+                int n = 1;
+                while (n < size.maxCoeff())
+                    n *= 2;
+                for (int d = 0; d < n*n; ++d) {
+                    Point2i p = order == EMortonOrder ? mortonCell((uint32_t) d)
+                                                      : hilbertCell(n, d);
+                    if (inside(p))
+                        result.push_back(p);
+                }
+            }
+            break;
+    }
+
+    return result;
+}
+
+BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize, ETraversalOrder order,
+                               const Point2i &offset)
+        : m_offset(offset), m_size(size), m_blockSize(blockSize) {
+    Vector2i numBlocks(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
-    m_direction = ERight;
-    m_block = Point2i(m_numBlocks / 2);
-    m_stepsLeft = 1;
-    m_numSteps = 1;
+    m_blocks = traverseGrid(numBlocks, order);
 }
 
 bool BlockGenerator::next(ImageBlock &block) {
-    tbb::mutex::scoped_lock lock(m_mutex);
-
-    if (m_blocksLeft == 0)
+    Point2i offset;
+    Vector2i size;
+    if (!next(offset, size))
         return false;
 
-    Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
-    block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
-
-    if (--m_blocksLeft == 0)
-        return true;
-
-    do {
-        switch (m_direction) {
-            case ERight: ++m_block.x(); break;
-            case EDown:  ++m_block.y(); break;
-            case ELeft:  --m_block.x(); break;
-            case EUp:    --m_block.y(); break;
-        }
+    block.setOffset(offset);
+    block.setSize(size);
+    return true;
+}
 
-        if (--m_stepsLeft == 0) {
-            m_direction = (m_direction + 1) % 4;
-            if (m_direction == ELeft || m_direction == ERight) 
-                ++m_numSteps;
-            m_stepsLeft = m_numSteps;
-        }
-    } while ((m_block.array() < 0).any() ||
-             (m_block.array() >= m_numBlocks.array()).any());
+bool BlockGenerator::next(Point2i &offset, Vector2i &size) {
+    int index = m_next++;
+    if (index >= (int) m_blocks.size())
+        return false;
 
+    offset = m_blocks[index] * m_blockSize;
+    size = (m_size - offset).cwiseMin(Vector2i::Constant(m_blockSize));
+    offset += m_offset;
     return true;
 }
 
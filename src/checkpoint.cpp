@@ -0,0 +1,147 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/checkpoint.h>
+#include <nori/block.h>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+static const char CheckpointMagic[8] = { 'N', 'O', 'R', 'I', 'C', 'K', 'P', 'T' };
+static const uint32_t CheckpointVersion = 3;
+
+CheckpointWriter::CheckpointWriter(const std::string &filename, uint64_t sceneHash)
+    : m_filename(filename), m_sceneHash(sceneHash) {
+    m_thread = std::thread([this] { run(); });
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+void CheckpointWriter::write(const ImageBlock &image, const CheckpointInfo &info) {
+    std::ostringstream os(std::ios::binary);
+    os.write(CheckpointMagic, sizeof(CheckpointMagic));
+    os.write((const char *) &CheckpointVersion, sizeof(CheckpointVersion));
+    os.write((const char *) &m_sceneHash, sizeof(m_sceneHash));
+    /* The render region, which depends on the crop window */
+    int32_t region[4] = { image.getOffset().x(), image.getOffset().y(),
+                          image.getSize().x(), image.getSize().y() };
+    os.write((const char *) region, sizeof(region));
+    os.write((const char *) &info, sizeof(info));
+    image.write(os);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending = os.str();
+    m_hasPending = true;
+    m_cond.notify_all();
+}
+
+void CheckpointWriter::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this] { return !m_hasPending && !m_busy; });
+}
+
+void CheckpointWriter::run() {
+    std::string tmpName = m_filename + ".tmp";
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cond.wait(lock, [this] { return m_hasPending || m_stop; });
+        if (!m_hasPending)
+            break;
+
+        std::string data;
+        data.swap(m_pending);
+        m_hasPending = false;
+        m_busy = true;
+        lock.unlock();
+
+        /* Write to a temporary file, make sure it has reached the
+           disk, and only then replace the previous checkpoint */
+        bool success = false;
+        FILE *file = fopen(tmpName.c_str(), "wb");
+        if (file) {
+            success = fwrite(data.data(), 1, data.size(), file) == data.size() &&
+                      fflush(file) == 0;
+#if !defined(_WIN32)
+            success = success && fsync(fileno(file)) == 0;
+#endif
+            success = fclose(file) == 0 && success;
+        }
+#if defined(_WIN32)
+        success = success && MoveFileExA(tmpName.c_str(), m_filename.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+        success = success && rename(tmpName.c_str(), m_filename.c_str()) == 0;
+#endif
+        if (!success)
+            cerr << "Warning: could not write the checkpoint \"" << m_filename << "\"" << endl;
+
+        lock.lock();
+        m_busy = false;
+        m_cond.notify_all();
+    }
+}
+
+bool loadCheckpoint(const std::string &filename, uint64_t sceneHash,
+                    ImageBlock &image, CheckpointInfo &info) {
+    std::ifstream is(filename, std::ios::binary);
+    if (!is)
+        return false;
+
+    char magic[sizeof(CheckpointMagic)];
+    uint32_t version = 0;
+    uint64_t hash = 0;
+    is.read(magic, sizeof(magic));
+    is.read((char *) &version, sizeof(version));
+    is.read((char *) &hash, sizeof(hash));
+    if (!is || memcmp(magic, CheckpointMagic, sizeof(magic)) != 0 || version != CheckpointVersion)
+        throw NoriException("\"%s\" is not a valid checkpoint!", filename);
+    if (hash != sceneHash)
+        throw NoriException("The checkpoint \"%s\" belongs to a different scene!", filename);
+
+    int32_t region[4];
+    is.read((char *) region, sizeof(region));
+    if (region[0] != image.getOffset().x() || region[1] != image.getOffset().y() ||
+        region[2] != image.getSize().x() || region[3] != image.getSize().y())
+        throw NoriException("The checkpoint \"%s\" covers the region %ix%i at (%i, %i), but "
+                            "%ix%i at (%i, %i) is rendered (was --crop changed?)", filename,
+                            region[2], region[3], region[0], region[1], image.getSize().x(),
+                            image.getSize().y(), image.getOffset().x(), image.getOffset().y());
+
+    is.read((char *) &info, sizeof(info));
+    image.read(is);
+    return true;
+}
+
+NORI_NAMESPACE_END
@@ -21,7 +21,11 @@
 #include <Eigen/LU>
 #include <filesystem/resolver.h>
 #include <iomanip>
+#include <fstream>
+#include <iterator>
 #include <nori/frame.h>
+#include <tbb/global_control.h>
+#include <tbb/task_scheduler_init.h>
 
 #if defined(PLATFORM_LINUX)
 #include <malloc.h>
@@ -171,6 +175,21 @@ std::string memString(size_t size, bool precise) {
     return os.str();
 }
 
+uint64_t hashFile(const std::string &filename) {
+    std::ifstream is(filename, std::ios::binary);
+    if (!is)
+        throw NoriException("Could not read \"%s\"", filename);
+    uint64_t hash = 14695981039346656037ULL;
+    for (std::istreambuf_iterator<char> it(is), end; it != end; ++it)
+        hash = (hash ^ (uint8_t) *it) * 1099511628211ULL;
+    return hash;
+}
+
+int getThreadCount() {
+    return (int) std::min((size_t) tbb::task_scheduler_init::default_num_threads(),
+        tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism));
+}
+
 filesystem::resolver *getFileResolver() {
     static filesystem::resolver *resolver = new filesystem::resolver();
     return resolver;
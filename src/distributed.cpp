@@ -0,0 +1,660 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/distributed.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/block.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/timer.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if !defined(_WIN32)
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <netdb.h>
+#  include <poll.h>
+#  include <signal.h>
+#  include <unistd.h>
+#  include <cerrno>
+#  include <cstring>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+#if !defined(_WIN32)
+
+namespace {
+
+/* All nodes are expected to have the same byte order and float format;
+   a mismatch is detected through the magic number */
+const uint32_t ProtocolMagic   = 0x49524f4e; /* "NORI" */
+const uint32_t ProtocolVersion = 1;
+
+/* A worker that takes this many times longer than the average for a task
+   (but at least the given number of ms) is considered lost */
+const double TaskTimeoutFactor = 10;
+const double TaskTimeoutMin    = 60000;
+
+/// Message types. Every message starts with one of these, followed by a payload
+enum EMessage : uint32_t {
+    EHello = 1,  ///< Worker -> coordinator: \ref Hello
+    EReject,     ///< Coordinator -> worker: the worker is incompatible
+    ETask,       ///< Coordinator -> worker: \ref Task
+    EResult,     ///< Worker -> coordinator: \ref ResultHeader and block data
+    EDone        ///< Coordinator -> worker: the image is complete
+};
+
+struct Hello {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sceneHash;
+    uint32_t threads;
+};
+
+/// A block of the image and the range of samples to be taken in it
+struct Task {
+    uint32_t id;
+    int32_t offset[2];
+    int32_t size[2];
+    uint32_t sampleIndex;
+    uint32_t sampleCount;
+};
+
+/// Followed by <tt>rows * cols</tt> weighted pixels (including the border)
+struct ResultHeader {
+    uint32_t id;
+    int32_t rows;
+    int32_t cols;
+};
+
+typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> PixelArray;
+
+/// Minimal blocking stream socket
+class Socket {
+public:
+    explicit Socket(int fd = -1) : m_fd(fd) { }
+    Socket(Socket &&s) : m_fd(s.m_fd), m_timeout(s.m_timeout) { s.m_fd = -1; }
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+    ~Socket() { if (m_fd >= 0) ::close(m_fd); }
+
+    int fd() const { return m_fd; }
+
+    /**
+     * \brief Set how long (in ms) receiving may wait for data before
+     * it throws an exception (-1: forever)
+     */
+    void setTimeout(int timeout) { m_timeout = timeout; }
+
+    void sendAll(const void *data, size_t size) {
+        const char *ptr = (const char *) data;
+        while (size > 0) {
+            ssize_t n = ::send(m_fd, ptr, size, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw NoriException("Could not send data: %s", strerror(errno));
+            ptr += n;
+            size -= (size_t) n;
+        }
+    }
+
+    void recvAll(void *data, size_t size) {
+        char *ptr = (char *) data;
+        while (size > 0) {
+            if (m_timeout >= 0) {
+                pollfd pfd;
+                pfd.fd = m_fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                int rv = poll(&pfd, 1, m_timeout);
+                if (rv < 0 && errno == EINTR)
+                    continue;
+                if (rv == 0)
+                    throw NoriException("Timed out while waiting for data");
+            }
+            ssize_t n = ::recv(m_fd, ptr, size, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0)
+                throw NoriException("Connection closed by peer");
+            if (n < 0)
+                throw NoriException("Could not receive data: %s", strerror(errno));
+            ptr += n;
+            size -= (size_t) n;
+        }
+    }
+
+    template <typename T> void send(const T &value) { sendAll(&value, sizeof(T)); }
+    template <typename T> T recv() { T value; recvAll(&value, sizeof(T)); return value; }
+
+private:
+    int m_fd;
+    int m_timeout = -1;
+};
+
+/**
+ * \brief Have the kernel probe a connection that has been idle for a
+ * while, so that a peer whose machine went down or became unreachable
+ * is noticed within about a minute (the system default is two hours)
+ *
+ * This doesn't catch a peer that hangs or was stopped, since its
+ * kernel still answers the probes.
+ */
+void enableKeepAlive(int fd) {
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+    int idle = 30, interval = 10, count = 3;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+}
+
+/// Split "host:port" into its parts (the host defaults to \c defaultHost)
+void splitAddress(const std::string &address, const char *defaultHost,
+                  std::string &host, std::string &port) {
+    size_t pos = address.rfind(':');
+    if (pos == std::string::npos) {
+        host = defaultHost ? defaultHost : "";
+        port = address;
+    } else {
+        host = address.substr(0, pos);
+        port = address.substr(pos + 1);
+    }
+}
+
+bool isUnixAddress(const std::string &address) {
+    return address.compare(0, 5, "unix:") == 0;
+}
+
+sockaddr_un unixAddress(const std::string &address) {
+    std::string path = address.substr(5);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        throw NoriException("Invalid socket path \"%s\"", path);
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+/// Create a socket that accepts connections on the given address
+Socket listenOn(const std::string &address) {
+    if (isUnixAddress(address)) {
+        sockaddr_un addr = unixAddress(address);
+        Socket s(::socket(AF_UNIX, SOCK_STREAM, 0));
+        ::unlink(addr.sun_path);
+        if (s.fd() < 0 || ::bind(s.fd(), (sockaddr *) &addr, sizeof(addr)) != 0 ||
+            ::listen(s.fd(), 64) != 0)
+            throw NoriException("Could not listen on \"%s\": %s", address, strerror(errno));
+        return s;
+    }
+
+    std::string host, port;
+    splitAddress(address, nullptr, host, port);
+    addrinfo hints, *info = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int rv = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &info);
+    if (rv != 0)
+        throw NoriException("Could not resolve \"%s\": %s", address, gai_strerror(rv));
+
+    for (addrinfo *ai = info; ai; ai = ai->ai_next) {
+        Socket s(::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+        int one = 1;
+        if (s.fd() < 0)
+            continue;
+        setsockopt(s.fd(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(s.fd(), ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(s.fd(), 64) == 0) {
+            freeaddrinfo(info);
+            return s;
+        }
+    }
+    freeaddrinfo(info);
+    throw NoriException("Could not listen on \"%s\": %s", address, strerror(errno));
+}
+
+/// Connect to a coordinator, retrying for a while if it isn't up yet
+Socket connectTo(const std::string &address) {
+    for (int attempt = 0; ; ++attempt) {
+        if (isUnixAddress(address)) {
+            sockaddr_un addr = unixAddress(address);
+            Socket s(::socket(AF_UNIX, SOCK_STREAM, 0));
+            if (s.fd() >= 0 && ::connect(s.fd(), (sockaddr *) &addr, sizeof(addr)) == 0)
+                return s;
+        } else {
+            std::string host, port;
+            splitAddress(address, "localhost", host, port);
+            addrinfo hints, *info = nullptr;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            int rv = getaddrinfo(host.c_str(), port.c_str(), &hints, &info);
+            if (rv != 0)
+                throw NoriException("Could not resolve \"%s\": %s", address, gai_strerror(rv));
+            for (addrinfo *ai = info; ai; ai = ai->ai_next) {
+                Socket s(::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+                if (s.fd() < 0 || ::connect(s.fd(), ai->ai_addr, ai->ai_addrlen) != 0)
+                    continue;
+                enableKeepAlive(s.fd());
+                freeaddrinfo(info);
+                return s;
+            }
+            freeaddrinfo(info);
+        }
+
+        if (attempt == 60)
+            throw NoriException("Could not connect to \"%s\": %s", address, strerror(errno));
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+}
+
+/**
+ * \brief Queue of the tasks that haven't been handed out yet
+ *
+ * Tasks of workers that fail are put back at the front of the queue
+ */
+class TaskQueue {
+public:
+    TaskQueue(std::vector<Task> &&tasks)
+        : m_pending(tasks.begin(), tasks.end()), m_remaining((int) tasks.size()) { }
+
+    /**
+     * \brief Take the next task from the queue
+     *
+     * If the queue is empty and \c wait is set, this blocks until a
+     * task is put back or all tasks are done.
+     *
+     * \return \c false if no task is available
+     */
+    bool pop(Task &task, bool wait) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_pending.empty()) {
+            if (!wait || m_remaining == 0)
+                return false;
+            m_cond.wait(lock);
+        }
+        task = m_pending.front();
+        m_pending.pop_front();
+        return true;
+    }
+
+    /// Put back the tasks of a failed worker
+    void requeue(const std::vector<Task> &tasks) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.insert(m_pending.begin(), tasks.begin(), tasks.end());
+        m_cond.notify_all();
+    }
+
+    /**
+     * \brief Mark a task as done
+     *
+     * \param latency
+     *     Time (in ms) from handing out the task to receiving its result
+     */
+    void done(double latency) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_latency += latency;
+        ++m_done;
+        if (--m_remaining == 0)
+            m_cond.notify_all();
+    }
+
+    /// Return the average latency of the tasks that are done (0 if there are none)
+    double averageLatency() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_done > 0 ? m_latency / m_done : 0;
+    }
+
+    /// Return the number of tasks that are not done
+    int remaining() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_remaining;
+    }
+
+private:
+    std::deque<Task> m_pending;
+    int m_remaining;
+    int m_done = 0;
+    double m_latency = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+/// Talk to a single worker: hand out tasks and merge the results
+void serveWorker(Socket socket, int workerID, uint64_t hash, TaskQueue &queue,
+                 ImageBlock &result, int blockSize, const ReconstructionFilter *filter,
+                 std::mutex &logMutex) {
+    auto log = [&](const std::string &message) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        cout << "Worker " << workerID << ": " << message << endl;
+    };
+
+    std::vector<Task> outstanding;
+    std::vector<double> handedOut; /* Time at which each outstanding task was sent */
+    Timer timer;
+    try {
+        if (socket.recv<uint32_t>() != EHello)
+            throw NoriException("Protocol error (expected a hello message)");
+        Hello hello = socket.recv<Hello>();
+        if (hello.magic != ProtocolMagic || hello.version != ProtocolVersion || hello.sceneHash != hash) {
+            log("rejected (incompatible version, platform or scene)");
+            socket.send<uint32_t>(EReject);
+            return;
+        }
+        log(tfm::format("connected (%i threads)", hello.threads));
+
+        /* Keep every thread of the worker busy, and one task in flight each */
+        size_t maxOutstanding = 2 * std::max(hello.threads, 1u);
+        ImageBlock block(Vector2i::Constant(blockSize), filter);
+        PixelArray pixels;
+
+        while (true) {
+            Task task;
+            while (outstanding.size() < maxOutstanding && queue.pop(task, outstanding.empty())) {
+                socket.send<uint32_t>(ETask);
+                socket.send(task);
+                outstanding.push_back(task);
+                handedOut.push_back(timer.elapsed());
+            }
+            if (outstanding.empty())
+                break; /* All tasks are done */
+
+            /* Give up on a worker whose oldest task takes much longer than
+               average, e.g. because it hangs, was stopped or can't be
+               reached anymore. Its tasks are then reassigned below */
+            double average = queue.averageLatency();
+            if (average > 0) {
+                double deadline = *std::min_element(handedOut.begin(), handedOut.end()) +
+                    std::max(TaskTimeoutMin, TaskTimeoutFactor * average);
+                socket.setTimeout((int) std::max(deadline - timer.elapsed(), 1.0));
+            }
+
+            if (socket.recv<uint32_t>() != EResult)
+                throw NoriException("Protocol error (expected a result message)");
+            ResultHeader header = socket.recv<ResultHeader>();
+            auto it = std::find_if(outstanding.begin(), outstanding.end(),
+                [&](const Task &t) { return t.id == header.id; });
+            if (it == outstanding.end())
+                throw NoriException("Protocol error (unexpected task %i)", header.id);
+
+            Vector2i size(it->size[0], it->size[1]);
+            int border = block.getBorderSize();
+            if (header.rows != size.y() + 2*border || header.cols != size.x() + 2*border)
+                throw NoriException("Protocol error (invalid block size)");
+            pixels.resize(header.rows, header.cols);
+            socket.recvAll(pixels.data(), sizeof(Color4f) * pixels.size());
+
+            block.setOffset(Point2i(it->offset[0], it->offset[1]));
+            block.setSize(size);
+            block.topLeftCorner(header.rows, header.cols) = pixels;
+            result.put(block);
+
+            size_t index = (size_t) (it - outstanding.begin());
+            queue.done(timer.elapsed() - handedOut[index]);
+            outstanding.erase(it);
+            handedOut.erase(handedOut.begin() + index);
+        }
+
+        socket.send<uint32_t>(EDone);
+    } catch (const std::exception &e) {
+        log(tfm::format("failed (%s), reassigning %i tasks", e.what(), outstanding.size()));
+        queue.requeue(outstanding);
+    }
+}
+
+} // namespace
+
+void renderCoordinator(Scene *scene, const std::string &filename,
+                       const std::string &address, const RenderOptions &options) {
+    signal(SIGPIPE, SIG_IGN);
+
+    const Camera *camera = scene->getCamera();
+    Point2i outputOffset;
+    Vector2i outputSize;
+    getRenderRegion(scene, outputOffset, outputSize);
+    ImageBlock result(outputSize, camera->getReconstructionFilter());
+    result.setOffset(outputOffset);
+    result.clear();
+
+    if (scene->getAdaptiveThreshold() > 0 || scene->getTimeBudget() > 0 || options.timeBudget > 0)
+        cout << "Warning: adaptive sampling and time budgets are not supported "
+                "in distributed mode and will be ignored" << endl;
+
+    /* One task per block and progressive pass */
+    uint32_t sampleCount = (uint32_t) scene->getSampler()->getSampleCount();
+    uint32_t passSampleCount = sampleCount;
+    if (scene->isProgressive())
+        passSampleCount = std::min(scene->getPassSampleCount(), sampleCount);
+
+    if (sampleCount > NORI_SEED_SAMPLES)
+        throw NoriException("At most %i samples per pixel are supported!", NORI_SEED_SAMPLES);
+
+    int blockSize = scene->getBlockSize() > 0 ? scene->getBlockSize() : NORI_BLOCK_SIZE;
+    BlockGenerator blockGenerator(outputSize, blockSize, scene->getBlockOrder(), outputOffset);
+    std::vector<Task> tasks;
+    for (uint32_t sampleIndex = 0; sampleIndex < sampleCount; sampleIndex += passSampleCount) {
+        Point2i offset;
+        Vector2i size;
+        blockGenerator.reset();
+        while (blockGenerator.next(offset, size)) {
+            Task task;
+            task.id = (uint32_t) tasks.size();
+            task.offset[0] = offset.x(); task.offset[1] = offset.y();
+            task.size[0] = size.x(); task.size[1] = size.y();
+            task.sampleIndex = options.seed * NORI_SEED_SAMPLES + sampleIndex;
+            task.sampleCount = std::min(passSampleCount, sampleCount - sampleIndex);
+            tasks.push_back(task);
+        }
+    }
+    int taskCount = (int) tasks.size();
+    TaskQueue queue(std::move(tasks));
+
+    /* Used to check that all processes render the same scene */
+    uint64_t hash = hashFile(filename);
+    Socket server = listenOn(address);
+    cout << "Waiting for workers on \"" << address << "\" (" << taskCount << " tasks) .." << endl;
+
+    std::vector<std::thread> workers;
+    std::mutex logMutex;
+    Timer timer, lapTimer;
+    int remaining;
+    while ((remaining = queue.remaining()) > 0) {
+        pollfd pfd;
+        pfd.fd = server.fd();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 200) > 0) {
+            Socket socket(::accept(server.fd(), nullptr, nullptr));
+            if (socket.fd() >= 0) {
+                /* Workers that hang are caught by the deadline in serveWorker() */
+                enableKeepAlive(socket.fd());
+                workers.emplace_back(serveWorker, std::move(socket), (int) workers.size() + 1,
+                    hash, std::ref(queue), std::ref(result), blockSize,
+                    camera->getReconstructionFilter(), std::ref(logMutex));
+            }
+        }
+
+        if (lapTimer.elapsed() > 10000) {
+            std::lock_guard<std::mutex> lock(logMutex);
+            cout << tfm::format("Rendering .. %.1f%% (%i/%i tasks), elapsed %s",
+                100.0 * (taskCount - remaining) / taskCount, taskCount - remaining,
+                taskCount, timeString(timer.elapsed())) << endl;
+            lapTimer.reset();
+        }
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+    if (isUnixAddress(address))
+        ::unlink(address.substr(5).c_str());
+
+    double elapsed = timer.elapsed();
+    cout << "Rendering done. (took " << timeString(elapsed) << ", "
+         << workers.size() << " workers)" << endl;
+
+    if (!options.writeOutput)
+        return;
+
+    saveImage(scene, result, filename, options, sampleCount, elapsed);
+}
+
+void renderWorker(Scene *scene, const std::string &filename, const std::string &address) {
+    signal(SIGPIPE, SIG_IGN);
+    scene->getIntegrator()->preprocess(scene);
+    int threadCount = getThreadCount();
+
+    Socket socket = connectTo(address);
+    Hello hello;
+    hello.magic = ProtocolMagic;
+    hello.version = ProtocolVersion;
+    hello.sceneHash = hashFile(filename);
+    hello.threads = (uint32_t) threadCount;
+    socket.send<uint32_t>(EHello);
+    socket.send(hello);
+    cout << "Connected to \"" << address << "\", rendering with " << threadCount << " threads .." << endl;
+
+    /* The calling thread receives tasks, and a set of render threads
+       (which block while waiting for tasks, hence not TBB) renders
+       them and sends back the results */
+    std::deque<Task> tasks;
+    bool finished = false;
+    int taskCount = 0;
+    std::mutex queueMutex, sendMutex;
+    std::condition_variable queueCond;
+
+    auto renderThread = [&] {
+        ImageBlock block(Vector2i::Constant(NORI_BLOCK_SIZE),
+            scene->getCamera()->getReconstructionFilter());
+        std::unique_ptr<ImageBlock> largeBlock;
+        std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+        PixelArray pixels;
+
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCond.wait(lock, [&] { return finished || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = tasks.front();
+                tasks.pop_front();
+            }
+
+            /* Blocks can be larger than the default size if the scene says so */
+            Vector2i size(task.size[0], task.size[1]);
+            ImageBlock *target = &block;
+            if (size.maxCoeff() > NORI_BLOCK_SIZE) {
+                if (!largeBlock || (largeBlock->getSize().array() < size.array()).any())
+                    largeBlock.reset(new ImageBlock(size, scene->getCamera()->getReconstructionFilter()));
+                target = largeBlock.get();
+            }
+            target->setOffset(Point2i(task.offset[0], task.offset[1]));
+            target->setSize(size);
+            renderBlock(scene, sampler.get(), *target, task.sampleIndex, task.sampleCount);
+
+            ResultHeader header;
+            header.id = task.id;
+            header.rows = size.y() + 2*target->getBorderSize();
+            header.cols = size.x() + 2*target->getBorderSize();
+            pixels = target->topLeftCorner(header.rows, header.cols);
+
+            try {
+                std::lock_guard<std::mutex> lock(sendMutex);
+                socket.send<uint32_t>(EResult);
+                socket.send(header);
+                socket.sendAll(pixels.data(), sizeof(Color4f) * pixels.size());
+            } catch (const std::exception &) {
+                /* The coordinator is gone; the receiving thread will notice */
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; ++i)
+        threads.emplace_back(renderThread);
+
+    auto shutdown = [&] {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            finished = true;
+        }
+        queueCond.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    };
+
+    try {
+        while (true) {
+            uint32_t message = socket.recv<uint32_t>();
+            if (message == ETask) {
+                Task task = socket.recv<Task>();
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    tasks.push_back(task);
+                }
+                queueCond.notify_one();
+                ++taskCount;
+            } else if (message == EDone) {
+                break;
+            } else if (message == EReject) {
+                throw NoriException("The coordinator rejected this worker. Are both "
+                                    "rendering the same scene with the same version of Nori?");
+            } else {
+                throw NoriException("Protocol error (unexpected message %i)", message);
+            }
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            tasks.clear();
+        }
+        shutdown();
+        throw;
+    }
+
+    shutdown();
+    cout << "Done. (rendered " << taskCount << " tasks)" << endl;
+}
+
+#else
+
+void renderCoordinator(Scene *, const std::string &, const std::string &, const RenderOptions &) {
+    throw NoriException("Distributed rendering is not supported on Windows!");
+}
+
+void renderWorker(Scene *, const std::string &, const std::string &) {
+    throw NoriException("Distributed rendering is not supported on Windows!");
+}
+
+#endif
+
+NORI_NAMESPACE_END
@@ -81,6 +81,8 @@ NoriScreen::NoriScreen(const ImageBlock &block)
     glBindTexture(GL_TEXTURE_2D, m_texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, block.getSize().x(), block.getSize().y(),
+            0, GL_RGBA, GL_FLOAT, nullptr);
 
     drawAll();
     setVisible(true);
@@ -92,18 +94,26 @@ NoriScreen::~NoriScreen() {
 }
 
 void NoriScreen::drawContents() {
-    /* Reload the partially rendered image onto the GPU */
-    m_block.lock();
+    /* Reload the partially rendered image onto the GPU. This is done
+       one band of rows at a time, so that the render threads are
+       only ever blocked from merging into a small part of the image */
     int borderSize = m_block.getBorderSize();
     const Vector2i &size = m_block.getSize();
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_texture);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) m_block.cols());
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size.x(), size.y(),
-            0, GL_RGBA, GL_FLOAT, (uint8_t *) m_block.data() +
-            (borderSize * m_block.cols() + borderSize) * sizeof(Color4f));
+    for (int band = 0; band < m_block.getBandCount(); ++band) {
+        int y0 = std::max(band * NORI_BAND_SIZE, borderSize),
+            y1 = std::min((band + 1) * NORI_BAND_SIZE, borderSize + size.y());
+        if (y0 >= y1)
+            continue;
+        m_block.lockBand(band);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0 - borderSize, size.x(), y1 - y0,
+                GL_RGBA, GL_FLOAT, (uint8_t *) m_block.data() +
+                (y0 * m_block.cols() + borderSize) * sizeof(Color4f));
+        m_block.unlockBand(band);
+    }
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    m_block.unlock();
 
     glViewport(0, GLsizei(36 * mPixelRatio), GLsizei(mPixelRatio*size[0]),
          GLsizei(mPixelRatio*size[1]));
@@ -45,10 +45,12 @@ public:
         return std::move(cloned);
     }
 
-    void prepare(const ImageBlock &block) {
+    void prepare(const Point2i &offset, uint32_t sampleIndex) {
+        /* Later passes use a different initial state, which
+           leaves the sequence of the first pass unchanged */
         m_random.seed(
-            block.getOffset().x(),
-            block.getOffset().y()
+            (uint64_t) offset.x() + ((uint64_t) sampleIndex << 32),
+            offset.y()
         );
     }
 
@@ -1,5 +1,6 @@
 #include <nori/integrator.h>
 #include <nori/scene.h>
+#include <nori/wavefront.h>
 #include <nori/warp.h>
 
 NORI_NAMESPACE_BEGIN
@@ -16,15 +17,46 @@ public:
 
 	Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const override {
 		Intersection its;
-		if (!scene->rayIntersect(ray, its)) {
+		bool found = scene->rayIntersect(ray, its);
+		return LiHit(scene, sampler, ray, found ? &its : nullptr, nullptr, 0);
+	}
+
+	Color3f LiPrimary(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+	                  const Intersection* hit, ShadowQueue& shadows,
+	                  uint32_t sample) const override {
+		return LiHit(scene, sampler, ray, hit, &shadows, sample);
+	}
+
+	void shade(const Scene* scene, Sampler* sampler, Wavefront& wavefront) const override {
+		for (size_t i = 0; i < wavefront.getHitCount(); ++i) {
+			uint32_t path = wavefront.getPath(i);
+			wavefront.addRadiance(path, LiHit(scene, sampler, wavefront.getRay(i), wavefront.getHit(i),
+			                                  &wavefront.getShadows(), path));
+		}
+	}
+
+	/**
+	@brief Estimate the visibility along a ray given its intersection
+
+	The hemisphere ray is queued if \c shadows is given
+	*/
+	Color3f LiHit(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+	              const Intersection* hit, ShadowQueue* shadows, uint32_t sample) const {
+		if (!hit) {
 			return Color3f(1.0f);
 		}
+		const Intersection& its = *hit;
 
 		// sample a new ray on the local hemisphere
 		Vector3f dir = Warp::squareToUniformHemisphere(sampler->next2D());
 		Ray3f newRay(its.p, its.shFrame.toWorld(dir), ray.mint, m_length);
 
-		if (scene->rayIntersect(newRay)) {
+		if (shadows) {
+			// the ray contributes once it turns out to be unoccluded
+			shadows->add(sample, newRay, Color3f(1.0f));
+			return Color3f(0.0f);
+		}
+		else if (scene->rayIntersect(newRay)) {
 			return Color3f(0.0f);
 		}
 		else {
@@ -32,6 +64,10 @@ public:
 		}
 	}
 
+	bool usesPrimaryHits() const override { return true; }
+
+	bool supportsWavefront() const override { return true; }
+
 	std::string toString() const {
 		return tfm::format(
 		  "AverageVisibility[\n"
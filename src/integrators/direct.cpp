@@ -3,6 +3,7 @@
 #include <nori/bsdf.h>
 #include <nori/emitter.h>
 #include <nori/warp.h>
+#include <nori/wavefront.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -39,47 +40,66 @@ public:
 
 	Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const override {
 		Intersection its;
-		if (!scene->rayIntersect(ray, its)) {
+		bool found = scene->rayIntersect(ray, its);
+		return LiHit(scene, sampler, ray, found ? &its : nullptr, nullptr, 0);
+	}
+
+	Color3f LiPrimary(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+	                  const Intersection* hit, ShadowQueue& shadows,
+	                  uint32_t sample) const override {
+		return LiHit(scene, sampler, ray, hit, &shadows, sample);
+	}
+
+	/**
+	@brief Estimate the radiance along a ray given its intersection
+
+	The shadow ray of emitter sampling is queued if \c shadows is given
+	*/
+	Color3f LiHit(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+	              const Intersection* hit, ShadowQueue* shadows, uint32_t sample) const {
+		if (!hit) {
 			return Color3f(0.0f);
 		}
+		const Intersection& its = *hit;
 
 		if (its.shape->isEmitter()) {
 			return its.shape->getEmitter()->eval(its, -ray.d);
 		}
 
+		// note we do not allocate samples for emitter and bsdf separately
+		// we just rely on 'sample per pixel'
 		Color3f estimation = 0;
 
-		if (m_strategy == EEmitter) {
-			float weight;
-			estimation += Li_emitter(scene, ray, its, sampler->next2D(), weight);
+		if (m_strategy != EBSDF) {
+			estimation += Li_emitter(scene, ray, its, sampler->next2D(), shadows, sample);
 		}
-		else if (m_strategy == EBSDF) {
-			float weight;
-			estimation += Li_bsdf(scene, ray, its, sampler->next2D(), weight);
-		}
-		else {
-			// note we do not allocate samples for emitter and bsdf separately
-			// we just rely on 'sample per pixel'
-
-			float weight1 = 0.0f, weight2 = 0.0f;
-			Color3f Li1 = Li_emitter(scene, ray, its, sampler->next2D(), weight1);
-			Color3f Li2 = Li_bsdf(scene, ray, its, sampler->next2D(), weight2);
-			estimation += weight1 * Li1 + weight2 * Li2;
+		if (m_strategy != EEmitter) {
+			float weight = 0.0f;
+			Color3f value = Li_bsdf(scene, ray, its, sampler->next2D(), weight);
+			estimation += (m_strategy == EMIS ? weight : 1.0f) * value;
 		}
 
 		return estimation;
 	}
 
+	/**
+	@brief Estimate the radiance that arrives from a sampled point on
+	an emitter (including the MIS weight)
+
+	If \c shadows is given, the shadow ray is queued and its radiance is
+	added once it turns out to be unoccluded. Otherwise, the ray is traced
+	right away.
+	*/
 	Color3f Li_emitter(const Scene* scene, const Ray3f& ray,
 	                   const Intersection& its, const Point2f& sample,
-	                   float& weight) const {
+	                   ShadowQueue* shadows, uint32_t index) const {
 		auto& emitterDistr = scene->getEmitterPDF();
 		Point2f _sample(sample);
 
 		// randomly pick an emitter
 		float pickPdf;
-		size_t index = emitterDistr.sampleReuse(_sample.x(), pickPdf);
-		Emitter* emitter = scene->getEmitters()[index];
+		size_t emitterIndex = emitterDistr.sampleReuse(_sample.x(), pickPdf);
+		Emitter* emitter = scene->getEmitters()[emitterIndex];
 
 		// sample the emitter
 		auto emitterSample = emitter->sample(its, _sample);
@@ -94,28 +114,54 @@ public:
 		Color3f bsdfVal = bsdf->eval(bRec);
 		if (bsdfVal.isZero()) return Color3f(0.0f);
 
+		float weight = 1.0f;  // no MIS for delta lights
+		if (m_strategy == EMIS && !emitter->isDelta()) {
+			float bsdfPdf = bsdf->pdf(bRec);
+			weight = miWeight(emitterSample.pdf, bsdfPdf);
+		}
+
+		float cosThetai = clamp(its.shFrame.n.dot(emitterSample.wi), 0.0f, 1.0f);
+		Color3f value = weight * (Ld * bsdfVal * cosThetai) / emitterSample.pdf;
+
 		// test visibility
 		// '-Epsilon' to avoid hitting the emitter
 		Ray3f shadowRay(its.p, emitterSample.wi, ray.mint, emitterSample.distance - Epsilon);
-		if (scene->rayIntersect(shadowRay)) {
+		if (shadows) {
+			shadows->add(index, shadowRay, value);
 			return Color3f(0.0f);
 		}
-
-		if (emitter->isDelta()) {
-			weight = 1.0f;  // no MIS for delta lights
-		}
-		else {
-			float bsdfPdf = bsdf->pdf(bRec);
-			weight = miWeight(emitterSample.pdf, bsdfPdf);
+		if (scene->rayIntersect(shadowRay)) {
+			return Color3f(0.0f);
 		}
 
-		float cosThetai = clamp(its.shFrame.n.dot(emitterSample.wi), 0.0f, 1.0f);
-		return (Ld * bsdfVal * cosThetai) / emitterSample.pdf;
+		return value;
 	}
 
 	Color3f Li_bsdf(const Scene* scene, const Ray3f& ray,
 	                const Intersection& its, const Point2f& sample,
 	                float& weight) const {
+		Ray3f reflectedRay;
+		float bsdfPdf;
+		Color3f bsdfVal = sampleBSDF(ray, its, sample, reflectedRay, bsdfPdf);
+		if (bsdfVal.isZero()) return Color3f(0.0f);
+
+		// find emitter along the reflected ray
+		Intersection its2;
+		if (scene->rayIntersect(reflectedRay, its2)) {
+			// note BSDF::sample() already returns eval() / pdf() * cos(theta)
+			return Le_bsdf(scene, its, reflectedRay, its2, bsdfPdf, weight) * bsdfVal;
+		}
+		else {
+			return Color3f(0.0f);
+		}
+	}
+
+	/**
+	@brief Sample the BSDF and return the reflected ray along with
+	BSDF::sample()'s weight and the pdf of the direction
+	*/
+	Color3f sampleBSDF(const Ray3f& ray, const Intersection& its, const Point2f& sample,
+	                   Ray3f& reflectedRay, float& bsdfPdf) const {
 		auto bsdf = its.shape->getBSDF();
 		BSDFQueryRecord bRec(its.toLocal(-ray.d), its.uv);
 
@@ -123,33 +169,70 @@ public:
 		Color3f bsdfVal = bsdf->sample(bRec, sample);
 		if (bsdfVal.isZero()) return Color3f(0.0f);
 
-		// find emitter along the reflected ray
 		Vector3f wo = its.shFrame.toWorld(bRec.wo);
-		Ray3f reflectedRay(its.p, wo, ray.mint, ray.maxt);
-		Intersection its2;
-		if (scene->rayIntersect(reflectedRay, its2)) {
-			auto shape = its2.shape;
-			if (shape->isEmitter()) {
-				Color3f Ld = shape->getEmitter()->eval(its2, -reflectedRay.d);
-				if (Ld.isZero()) return Color3f(0.0f);
+		reflectedRay = Ray3f(its.p, wo, ray.mint, ray.maxt);
 
-				float emitterPdf = shape->pdf(its, its2) *
-				                   scene->getEmitterPDF().getNormalization();
+		// TODO delta BSDF
+		bsdfPdf = bsdf->pdf(bRec);
+		return bsdfVal;
+	}
 
-				// TODO delta BSDF
-				float bsdfPdf = bsdf->pdf(bRec);
+	/**
+	@brief Return the radiance that is emitted towards the origin of a
+	BSDF-sampled ray at its intersection \c its2
+	*/
+	Color3f Le_bsdf(const Scene* scene, const Intersection& its, const Ray3f& reflectedRay,
+	                const Intersection& its2, float bsdfPdf, float& weight) const {
+		auto shape = its2.shape;
+		if (!shape->isEmitter()) return Color3f(0.0f);
+
+		Color3f Ld = shape->getEmitter()->eval(its2, -reflectedRay.d);
+		if (Ld.isZero()) return Color3f(0.0f);
+
+		float emitterPdf = shape->pdf(its, its2) *
+		                   scene->getEmitterPDF().getNormalization();
 
-				weight = miWeight(bsdfPdf, emitterPdf);
+		weight = miWeight(bsdfPdf, emitterPdf);
+		return Ld;
+	}
+
+	void shade(const Scene* scene, Sampler* sampler, Wavefront& wavefront) const override {
+		for (size_t i = 0; i < wavefront.getHitCount(); ++i) {
+			uint32_t path = wavefront.getPath(i);
+			const Ray3f& ray = wavefront.getRay(i);
+			const Intersection* its = wavefront.getHit(i);
+			if (!its) continue;
 
-				// note BSDF::sample() already returns eval() / pdf() * cos(theta)
-				return Ld * bsdfVal;
+			if (wavefront.getDepth() > 0) {
+				// the BSDF-sampled ray of the path (see Li_bsdf())
+				float weight = 1.0f;
+				Color3f Ld = Le_bsdf(scene, wavefront.vertex(path), ray, *its,
+				                     wavefront.pdf(path), weight);
+				if (m_strategy != EMIS) weight = 1.0f;
+				wavefront.addRadiance(path, weight * Ld * wavefront.throughput(path));
+				continue;
 			}
-			else {
-				return Color3f(0.0f);
+
+			if (its->shape->isEmitter()) {
+				wavefront.addRadiance(path, its->shape->getEmitter()->eval(*its, -ray.d));
+				continue;
+			}
+
+			// same samples as in Li(), but the rays are traced later on
+			if (m_strategy != EBSDF) {
+				Li_emitter(scene, ray, *its, sampler->next2D(), &wavefront.getShadows(), path);
+			}
+			if (m_strategy != EEmitter) {
+				Ray3f reflectedRay;
+				float bsdfPdf;
+				Color3f bsdfVal = sampleBSDF(ray, *its, sampler->next2D(), reflectedRay, bsdfPdf);
+				if (!bsdfVal.isZero()) {
+					wavefront.throughput(path) = bsdfVal;
+					wavefront.pdf(path) = bsdfPdf;
+					wavefront.vertex(path) = *its;
+					wavefront.extend(path, reflectedRay);
+				}
 			}
-		}
-		else {
-			return Color3f(0.0f);
 		}
 	}
 
@@ -157,6 +240,10 @@ public:
 		return pdfA / (pdfA + pdfB);
 	}
 
+	bool usesPrimaryHits() const override { return true; }
+
+	bool supportsWavefront() const override { return true; }
+
 	std::string toString() const {
 		std::string strategy;
 		if (m_strategy == EEmitter) {
@@ -1,5 +1,6 @@
 #include <nori/integrator.h>
 #include <nori/scene.h>
+#include <nori/wavefront.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -13,15 +14,37 @@ public:
 
 	Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f& ray) const override {
 		Intersection its;
-		if (!scene->rayIntersect(ray, its)) {
+		bool found = scene->rayIntersect(ray, its);
+		return LiHit(found ? &its : nullptr);
+	}
+
+	Color3f LiPrimary(const Scene* scene, Sampler* sampler, const Ray3f& ray,
+	                  const Intersection* hit, ShadowQueue& shadows,
+	                  uint32_t sample) const override {
+		return LiHit(hit);
+	}
+
+	void shade(const Scene* scene, Sampler* sampler, Wavefront& wavefront) const override {
+		for (size_t i = 0; i < wavefront.getHitCount(); ++i) {
+			wavefront.addRadiance(wavefront.getPath(i), LiHit(wavefront.getHit(i)));
+		}
+	}
+
+	Color3f LiHit(const Intersection* hit) const {
+		if (!hit) {
 			return Color3f(0.0f);
 		}
+		const Intersection& its = *hit;
 
 		// return the component-wise absolute value of the shading normal as a color
 		Normal3f n = its.shFrame.n.cwiseAbs();
 		return Color3f(n.x(), n.y(), n.z());
 	}
 
+	bool usesPrimaryHits() const override { return true; }
+
+	bool supportsWavefront() const override { return true; }
+
 	std::string toString() const {
 		return "NormalIntegrator[]";
 	}
@@ -20,138 +20,230 @@
 #include <nori/scene.h>
 #include <nori/camera.h>
 #include <nori/block.h>
-#include <nori/timer.h>
 #include <nori/bitmap.h>
-#include <nori/sampler.h>
-#include <nori/integrator.h>
+#include <nori/render.h>
+#include <nori/benchmark.h>
+#include <nori/distributed.h>
+#include <nori/numa.h>
+#include <nori/device.h>
 #include <nori/gui.h>
-#include <tbb/parallel_for.h>
-#include <tbb/blocked_range.h>
 #include <filesystem/resolver.h>
-#include <thread>
+#include <tbb/global_control.h>
+#include <memory>
+#include <cstdlib>
+#include <cstdio>
 
 using namespace nori;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
-
-    /* Clear the block contents */
-    block.clear();
-
-    /* For each pixel and pixel sample sample */
-    for (int y=0; y<size.y(); ++y) {
-        for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
-                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
-
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
-
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+static void printUsage(const char *name) {
+    cerr << "Syntax: " << name << " [options] <scene.xml | image.exr>" << endl
+         << "        " << name << " --benchmark <name | list> [args]" << endl
+         << "Options:" << endl
+         << "   --headless   Render without a preview window and print progress" << endl
+         << "                on the console (default when no display is available)" << endl
+         << "   --time-budget <seconds>" << endl
+         << "                Render progressive passes until the time budget is used up" << endl
+         << "                (overrides the timeBudget property of the scene)" << endl
+         << "   --checkpoint <seconds>" << endl
+         << "                Periodically save the partially rendered image to scene.checkpoint" << endl
+         << "   --resume     Continue from scene.checkpoint of an interrupted render" << endl
+         << "   --crop <x,y,width,height>" << endl
+         << "                Only render the given crop window of the image" << endl
+         << "                (overrides the crop properties of the camera)" << endl
+         << "   --pad-crop   Pad the output of a cropped render to the full image size, e.g." << endl
+         << "                to merge it into a full-frame render with a different --seed" << endl
+         << "   --cost-map   Save the time spent on every pixel to scene.cost.exr" << endl
+         << "                and list the slowest blocks" << endl
+         << "   --no-packets Trace the camera rays one by one instead of in batches" << endl
+         << "   --wavefront  Render the paths of a block in bulk, one stage at a time" << endl
+         << "   --sort-batch <rays>" << endl
+         << "                Sort the rays and hits of the wavefront engine in windows of" << endl
+         << "                the given size before tracing and shading them" << endl
+         << "   --threads <count>" << endl
+         << "                Limit the number of threads used for rendering and by Embree" << endl
+         << "   --pin        Pin every thread to its own core" << endl
+         << "   --embree <config>" << endl
+         << "                Configure the Embree device, e.g. \"isa=avx2,verbose=1\"" << endl
+         << "                (overrides the embreeConfig property of the scene)" << endl
+         << "   --scaling-sweep" << endl
+         << "                Render the scene with 1, 2, 4, .. threads and report the" << endl
+         << "                throughput and parallel efficiency (see --time-budget)" << endl
+         << "   --numa       Render every part of the image on the cores of one NUMA" << endl
+         << "                node, and spread the scene data across all nodes" << endl
+         << "   --weighted   Also save the unnormalized image and filter weights to" << endl
+         << "                scene.weighted.exr, which can be combined using nori-merge" << endl
+         << "   --seed <0-" << NORI_MAX_SEED << ">" << endl
+         << "                Seed of the sample sequences. Renders that are merged must" << endl
+         << "                use different seeds, since they are otherwise identical" << endl
+         << "   --listen <unix:/path | [host:]port>" << endl
+         << "                Act as coordinator of a distributed render and hand out" << endl
+         << "                blocks to the workers that connect to the given address" << endl
+         << "   --connect <unix:/path | host:port>" << endl
+         << "                Act as worker of a distributed render of the same scene" << endl;
+}
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
-            }
-        }
+/// Parse a positive number of seconds passed to the given option
+static bool parseSeconds(int argc, char **argv, int i, float &value) {
+    char *end = nullptr;
+    if (i+1 < argc)
+        value = std::strtof(argv[i+1], &end);
+    if (!end || *end != '\0' || value <= 0) {
+        cerr << argv[i] << " expects a positive number of seconds" << endl;
+        return false;
     }
+    return true;
 }
 
-static void render(Scene *scene, const std::string &filename) {
-    const Camera *camera = scene->getCamera();
-    Vector2i outputSize = camera->getOutputSize();
-    scene->getIntegrator()->preprocess(scene);
-
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
-
-    /* Allocate memory for the entire output image and clear it */
-    ImageBlock result(outputSize, camera->getReconstructionFilter());
-    result.clear();
-
-    /* Create a window that visualizes the partially rendered result */
-    nanogui::init();
-    NoriScreen *screen = new NoriScreen(result);
-
-    /* Do the following in parallel and asynchronously */
-    std::thread render_thread([&] {
-        cout << "Rendering .. ";
-        cout.flush();
-        Timer timer;
-
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
-
-        auto map = [&](const tbb::blocked_range<int> &range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
-
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
-
-            for (int i=range.begin(); i<range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
-
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
-
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
-
-                /* The image block has been processed. Now add it to
-                   the "big" block that represents the entire image */
-                result.put(block);
+int main(int argc, char **argv) {
+    RenderOptions options;
+    options.headless = !isDisplayAvailable();
+    std::string sceneName, listenAddress, connectAddress, embreeConfig, benchmarkName;
+    std::vector<std::string> benchmarkArgs;
+    int crop[4], cropFields = 0, threads = 0;
+    bool pin = false, scalingSweep = false;
+
+    for (int i=1; i<argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--benchmark") {
+            /* The remaining arguments belong to the benchmark */
+            if (i+1 >= argc) {
+                printUsage(argv[0]);
+                return -1;
             }
-        };
-
-        /// Uncomment the following line for single threaded rendering
-        // map(range);
-
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
-
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
-    });
-
-    /* Enter the application main loop */
-    nanogui::mainloop();
-
-    /* Shut down the user interface */
-    render_thread.join();
-
-    delete screen;
-    nanogui::shutdown();
-
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+            benchmarkName = argv[i+1];
+            benchmarkArgs.assign(argv + i + 2, argv + argc);
+            break;
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--time-budget" || arg == "--checkpoint") {
+            if (!parseSeconds(argc, argv, i, arg == "--time-budget" ? options.timeBudget
+                                                                    : options.checkpointInterval))
+                return -1;
+            ++i;
+        } else if (arg == "--resume") {
+            options.resume = true;
+        } else if (arg == "--weighted") {
+            options.weightedOutput = true;
+        } else if (arg == "--seed") {
+            char *end = nullptr;
+            unsigned long seed = 0;
+            if (i+1 < argc)
+                seed = std::strtoul(argv[i+1], &end, 10);
+            if (!end || *end != '\0' || seed > NORI_MAX_SEED) {
+                cerr << "--seed expects a number from 0 to " << NORI_MAX_SEED << endl;
+                return -1;
+            }
+            options.seed = (uint32_t) seed;
+            ++i;
+        } else if (arg == "--crop") {
+            char end = '\0';
+            if (i+1 < argc)
+                cropFields = std::sscanf(argv[i+1], "%i,%i,%i,%i%c",
+                    &crop[0], &crop[1], &crop[2], &crop[3], &end);
+            if (cropFields != 4) {
+                cerr << "--crop expects the crop window as x,y,width,height" << endl;
+                return -1;
+            }
+            ++i;
+        } else if (arg == "--pad-crop") {
+            options.padCrop = true;
+        } else if (arg == "--cost-map") {
+            options.costMap = true;
+        } else if (arg == "--no-packets") {
+            options.packets = false;
+        } else if (arg == "--wavefront") {
+            options.wavefront = true;
+        } else if (arg == "--sort-batch") {
+            char *end = nullptr;
+            if (i+1 < argc)
+                options.sortBatch = (int) std::strtol(argv[i+1], &end, 10);
+            if (!end || *end != '\0' || options.sortBatch <= 0) {
+                cerr << "--sort-batch expects a positive number of rays" << endl;
+                return -1;
+            }
+            ++i;
+        } else if (arg == "--numa") {
+            options.numa = true;
+        } else if (arg == "--threads") {
+            char *end = nullptr;
+            if (i+1 < argc)
+                threads = (int) std::strtol(argv[i+1], &end, 10);
+            if (!end || *end != '\0' || threads <= 0) {
+                cerr << "--threads expects a positive number" << endl;
+                return -1;
+            }
+            ++i;
+        } else if (arg == "--pin") {
+            pin = true;
+        } else if (arg == "--scaling-sweep") {
+            scalingSweep = true;
+        } else if (arg == "--embree" && i+1 < argc) {
+            embreeConfig = argv[++i];
+        } else if ((arg == "--listen" || arg == "--connect") && i+1 < argc) {
+            (arg == "--listen" ? listenAddress : connectAddress) = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            cerr << "Unknown option \"" << arg << "\"" << endl;
+            printUsage(argv[0]);
+            return -1;
+        } else if (sceneName.empty()) {
+            sceneName = arg;
+        } else {
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
 
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
-    outputName += ".exr";
+    if (sceneName.empty() && benchmarkName.empty()) {
+        printUsage(argv[0]);
+        return -1;
+    }
 
-    /* Save using the OpenEXR format */
-    bitmap->save(outputName);
-}
+    /* --benchmark takes precedence over --scaling-sweep */
+    scalingSweep = scalingSweep && benchmarkName.empty();
+
+    /* Apply the thread count and pinning to TBB and Embree alike. The
+       scaling sweep sets its own limits, which must not be capped by
+       an outer one (TBB uses the smallest), so it gets the thread count
+       as the largest one to sweep over instead */
+    std::unique_ptr<tbb::global_control> threadLimit;
+    std::string deviceConfig;
+    if (threads > 0 && !scalingSweep) {
+        threadLimit.reset(new tbb::global_control(
+            tbb::global_control::max_allowed_parallelism, (size_t) threads));
+        deviceConfig = tfm::format("threads=%i", threads);
+    }
+    std::unique_ptr<ThreadPinning> pinning;
+    if (pin) {
+        pinning.reset(new ThreadPinning());
+        deviceConfig += deviceConfig.empty() ? "set_affinity=1" : ",set_affinity=1";
+    }
+    if (!embreeConfig.empty())
+        deviceConfig += (deviceConfig.empty() ? "" : ",") + embreeConfig;
+    EmbreeDevice::setConfig(deviceConfig);
+
+    if (scalingSweep) {
+        benchmarkName = "scaling";
+        if (options.timeBudget > 0) {
+            benchmarkArgs.push_back("--time");
+            benchmarkArgs.push_back(std::to_string(options.timeBudget));
+        }
+        if (threads > 0) {
+            benchmarkArgs.push_back("--max-threads");
+            benchmarkArgs.push_back(std::to_string(threads));
+        }
+        benchmarkArgs.push_back(sceneName);
+    }
 
-int main(int argc, char **argv) {
-    if (argc != 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml>" << endl;
-        return -1;
+    if (!benchmarkName.empty()) {
+        try {
+            return runBenchmark(benchmarkName, benchmarkArgs);
+        } catch (const std::exception &e) {
+            cerr << "Fatal error: " << e.what() << endl;
+            return -1;
+        }
     }
 
-    filesystem::path path(argv[1]);
+    filesystem::path path(sceneName);
 
     try {
         if (path.extension() == "xml") {
@@ -160,14 +252,32 @@ int main(int argc, char **argv) {
                resources (OBJ files, textures) using relative paths */
             getFileResolver()->prepend(path.parent_path());
 
-            std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+            /* In NUMA mode, the scene data is interleaved across
+               the nodes, since all of them read it while rendering */
+            if (options.numa)
+                setInterleavedAllocation(true);
+            std::unique_ptr<NoriObject> root(loadFromXML(sceneName));
+            if (options.numa)
+                setInterleavedAllocation(false);
 
             /* When the XML root object is a scene, start rendering it .. */
-            if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), argv[1]);
+            if (root->getClassType() == NoriObject::EScene) {
+                Scene *scene = static_cast<Scene *>(root.get());
+                if (cropFields == 4)
+                    scene->getCamera()->setCropWindow(Point2i(crop[0], crop[1]),
+                                                      Vector2i(crop[2], crop[3]));
+                if (!listenAddress.empty())
+                    renderCoordinator(scene, sceneName, listenAddress, options);
+                else if (!connectAddress.empty())
+                    renderWorker(scene, sceneName, connectAddress);
+                else
+                    render(scene, sceneName, options);
+            }
         } else if (path.extension() == "exr") {
             /* Alternatively, provide a basic OpenEXR image viewer */
-            Bitmap bitmap(argv[1]);
+            if (options.headless)
+                throw NoriException("The image viewer requires a display!");
+            Bitmap bitmap(sceneName);
             ImageBlock block(Vector2i((int) bitmap.cols(), (int) bitmap.rows()), nullptr);
             block.fromBitmap(bitmap);
             nanogui::init();
@@ -176,7 +286,7 @@ int main(int argc, char **argv) {
             delete screen;
             nanogui::shutdown();
         } else {
-            cerr << "Fatal error: unknown file \"" << argv[1]
+            cerr << "Fatal error: unknown file \"" << sceneName
                  << "\", expected an extension of type .xml or .exr" << endl;
         }
     } catch (const std::exception &e) {
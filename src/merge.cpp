@@ -0,0 +1,196 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* =======================================================================
+     Combines weighted images of the same scene (see the --weighted option
+     of nori), e.g. from independent renderings on several machines. The
+     images are processed a few scanlines at a time, so that the memory
+     usage doesn't depend on the image height or the number of inputs.
+     The inputs must have been rendered with different seeds, since their
+     samples would otherwise be identical.
+ * ======================================================================= */
+
+#include <nori/common.h>
+#include <ImfInputFile.h>
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfStringAttribute.h>
+#include <memory>
+#include <map>
+#include <sstream>
+#include <cstring>
+
+#define NORI_MERGE_ROWS 64 /* Number of scanlines that are processed at once */
+
+using namespace nori;
+
+static void printUsage(const char *name) {
+    cerr << "Syntax: " << name << " [--weighted] <output.exr> <input.weighted.exr> [..]" << endl
+         << "Sums the unnormalized pixels and filter weights of the input images" << endl
+         << "(written by nori --weighted) and saves the normalized result." << endl
+         << "Options:" << endl
+         << "   --weighted   Save the sums without normalizing them, so that the" << endl
+         << "                output can be merged again" << endl;
+}
+
+/// Attach the R, G, B, W channels of a buffer holding the given rows to a frame buffer
+static Imf::FrameBuffer rowBuffer(float *buffer, const Imath::Box2i &dw, int y,
+                                  bool weighted) {
+    size_t compStride = sizeof(float),
+           pixelStride = 4 * compStride,
+           rowStride = pixelStride * (dw.max.x - dw.min.x + 1);
+
+    /* OpenEXR addresses pixels by their absolute coordinates */
+    char *ptr = reinterpret_cast<char *>(buffer)
+        - (ptrdiff_t) (y * rowStride) - (ptrdiff_t) (dw.min.x * pixelStride);
+
+    const char *names[] = { "R", "G", "B", "W" };
+    Imf::FrameBuffer frameBuffer;
+    for (int i = 0; i < (weighted ? 4 : 3); ++i) {
+        frameBuffer.insert(names[i], Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+        ptr += compStride;
+    }
+    return frameBuffer;
+}
+
+/// Return the value of a string attribute (or an empty string)
+static std::string attribute(const Imf::Header &header, const char *name) {
+    const Imf::StringAttribute *attr = header.findTypedAttribute<Imf::StringAttribute>(name);
+    return attr ? attr->value() : std::string();
+}
+
+/**
+ * \brief Return the seeds of the renderings that are combined in an image
+ *
+ * Merged images list the seeds of all of their inputs. Images without
+ * a seed were rendered with the samples of seed 0.
+ */
+static std::vector<uint32_t> seeds(const Imf::Header &header) {
+    std::istringstream is(attribute(header, "seed"));
+    std::vector<uint32_t> result;
+    uint32_t seed;
+    while (is >> seed)
+        result.push_back(seed);
+    if (result.empty())
+        result.push_back(0);
+    return result;
+}
+
+static void merge(const std::string &outputName, const std::vector<std::string> &inputNames,
+                  bool weightedOutput) {
+    std::vector<std::unique_ptr<Imf::InputFile>> inputs;
+    uint64_t spp = 0;
+    std::map<uint32_t, std::string> seedInputs;
+    for (const std::string &name : inputNames) {
+        inputs.emplace_back(new Imf::InputFile(name.c_str()));
+        const Imf::Header &header = inputs.back()->header();
+        const Imath::Box2i &dw = header.dataWindow(), &dw0 = inputs[0]->header().dataWindow();
+
+        const char *names[] = { "R", "G", "B", "W" };
+        for (const char *ch : names) {
+            if (!header.channels().findChannel(ch))
+                throw NoriException("\"%s\" is not a weighted image (channel %s is missing)!", name, ch);
+        }
+        if (dw.min.x != dw0.min.x || dw.min.y != dw0.min.y ||
+            dw.max.x != dw0.max.x || dw.max.y != dw0.max.y)
+            throw NoriException("\"%s\" and \"%s\" have different dimensions!", name, inputNames[0]);
+
+        std::string value = attribute(header, "spp");
+        if (!value.empty())
+            spp += std::strtoull(value.c_str(), nullptr, 10);
+
+        for (uint32_t seed : seeds(header)) {
+            auto result = seedInputs.emplace(seed, name);
+            if (!result.second)
+                throw NoriException("\"%s\" and \"%s\" were both rendered with seed %i, so their "
+                                    "samples are identical! Render them using different values "
+                                    "of --seed.", result.first->second, name, seed);
+        }
+    }
+
+    const Imf::Header &header0 = inputs[0]->header();
+    Imath::Box2i dw = header0.dataWindow();
+    int width = dw.max.x - dw.min.x + 1;
+
+    cout << "Merging " << inputs.size() << " images of " << width << "x"
+         << dw.max.y - dw.min.y + 1 << " pixels into \"" << outputName << "\"" << endl;
+
+    Imf::Header header(header0.displayWindow(), dw);
+    header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    header.insert("spp", Imf::StringAttribute(std::to_string(spp)));
+    std::string seedList;
+    for (const auto &entry : seedInputs)
+        seedList += (seedList.empty() ? "" : " ") + std::to_string(entry.first);
+    header.insert("seed", Imf::StringAttribute(seedList));
+    const char *names[] = { "R", "G", "B", "W" };
+    for (int i = 0; i < (weightedOutput ? 4 : 3); ++i)
+        header.channels().insert(names[i], Imf::Channel(Imf::FLOAT));
+    Imf::OutputFile output(outputName.c_str(), header);
+
+    std::vector<float> sum((size_t) width * NORI_MERGE_ROWS * 4),
+                       row((size_t) width * NORI_MERGE_ROWS * 4);
+
+    for (int y = dw.min.y; y <= dw.max.y; y += NORI_MERGE_ROWS) {
+        int rows = std::min(NORI_MERGE_ROWS, dw.max.y - y + 1);
+        size_t count = (size_t) width * rows * 4;
+        std::fill(sum.begin(), sum.begin() + count, 0.f);
+
+        for (auto &input : inputs) {
+            input->setFrameBuffer(rowBuffer(row.data(), dw, y, true));
+            input->readPixels(y, y + rows - 1);
+            for (size_t i = 0; i < count; ++i)
+                sum[i] += row[i];
+        }
+
+        if (!weightedOutput) {
+            for (size_t i = 0; i < count; i += 4) {
+                float w = sum[i + 3], scale = w != 0 ? 1.f / w : 0.f;
+                for (int j = 0; j < 3; ++j)
+                    sum[i + j] *= scale;
+            }
+        }
+
+        output.setFrameBuffer(rowBuffer(sum.data(), dw, y, weightedOutput));
+        output.writePixels(rows);
+    }
+}
+
+int main(int argc, char **argv) {
+    bool weightedOutput = false;
+    std::vector<std::string> filenames;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--weighted") == 0)
+            weightedOutput = true;
+        else
+            filenames.push_back(argv[i]);
+    }
+
+    if (filenames.size() < 2) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    try {
+        merge(filenames[0], std::vector<std::string>(filenames.begin() + 1, filenames.end()),
+              weightedOutput);
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
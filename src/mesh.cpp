@@ -21,6 +21,7 @@
 #include <nori/bsdf.h>
 #include <nori/emitter.h>
 #include <nori/warp.h>
+#include <nori/numa.h>
 #include <Eigen/Geometry>
 
 NORI_NAMESPACE_BEGIN
@@ -28,7 +29,42 @@ NORI_NAMESPACE_BEGIN
 Mesh::Mesh(const PropertyList &props) :
     Shape(props) {}
 
-Mesh::~Mesh() {}
+Mesh::~Mesh() {
+	// the loader must not outlive the mesh (its errors were reported before)
+	try {
+		waitUntilLoaded();
+	} catch (...) {
+	}
+}
+
+void Mesh::loadAsync(const std::function<void()> &load) {
+	if (!m_loading)
+		m_loading.reset(new tbb::task_group());
+
+	// the worker thread allocates the mesh with the policy of the parsing thread (--numa)
+	bool interleave = isInterleavedAllocation();
+	m_loading->run([this, load, interleave] {
+		// the task may also run on a waiting thread, whose policy is restored afterwards
+		bool previous = isInterleavedAllocation();
+		if (interleave != previous)
+			setInterleavedAllocation(interleave);
+		try {
+			load();
+			buildSamplingTable();
+		} catch (...) {
+			if (interleave != previous)
+				setInterleavedAllocation(previous);
+			throw;
+		}
+		if (interleave != previous)
+			setInterleavedAllocation(previous);
+	});
+}
+
+void Mesh::waitUntilLoaded() {
+	if (m_loading)
+		m_loading->wait();
+}
 
 float Mesh::triangleArea(uint32_t index) const {
 	uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
@@ -0,0 +1,229 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/numa.h>
+#include <tbb/task_arena.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_group.h>
+#include <tbb/task_scheduler_observer.h>
+#include <fstream>
+#include <thread>
+
+#if defined(__linux__)
+#  include <sched.h>
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#endif
+
+/* Memory policies of set_mempolicy(2), see <numaif.h> */
+#define NORI_MPOL_DEFAULT    0
+#define NORI_MPOL_INTERLEAVE 3
+
+NORI_NAMESPACE_BEGIN
+
+/// Parse a list of CPUs such as "0-15,32-47"
+static std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    for (const std::string &range : tokenize(list, ",")) {
+        std::vector<std::string> bounds = tokenize(range, "-");
+        if (bounds.empty())
+            continue;
+        int first = toInt(bounds[0]), last = bounds.size() > 1 ? toInt(bounds[1]) : first;
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+std::vector<std::vector<int>> getNumaNodes() {
+    std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+    for (int node = 0; ; ++node) {
+        std::ifstream is(tfm::format("/sys/devices/system/node/node%i/cpulist", node));
+        if (!is)
+            break;
+        std::string list;
+        std::getline(is, list);
+        std::vector<int> cpus = parseCpuList(list);
+        if (!cpus.empty()) /* Skip memory-only nodes */
+            nodes.push_back(cpus);
+    }
+#endif
+    if (nodes.empty()) {
+        std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+        for (size_t i = 0; i < cpus.size(); ++i)
+            cpus[i] = (int) i;
+        nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+/// Policy of the current thread, as set by setInterleavedAllocation()
+static thread_local bool interleavedAllocation = false;
+
+bool isInterleavedAllocation() {
+    return interleavedAllocation;
+}
+
+void setInterleavedAllocation(bool interleave) {
+    interleavedAllocation = interleave;
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    if (interleave) {
+        unsigned long mask[16] = { 0 };
+        int nodeCount = 0;
+        for (int node = 0; node < (int) (sizeof(mask) * 8); ++node) {
+            std::ifstream is(tfm::format("/sys/devices/system/node/node%i/meminfo", node));
+            if (!is)
+                continue;
+            mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+            ++nodeCount;
+        }
+        if (nodeCount > 1)
+            syscall(SYS_set_mempolicy, NORI_MPOL_INTERLEAVE, mask, sizeof(mask) * 8 + 1);
+    } else {
+        syscall(SYS_set_mempolicy, NORI_MPOL_DEFAULT, nullptr, 0);
+    }
+#else
+    (void) interleave;
+#endif
+}
+
+/**
+ * Pins the threads that enter an arena to the cores of its node, and
+ * restores their previous affinity when they leave (TBB worker threads
+ * move between arenas). The threads also go back to allocating memory
+ * on the node they are running on.
+ */
+class NodeObserver : public tbb::task_scheduler_observer {
+public:
+    NodeObserver(tbb::task_arena &arena, const std::vector<int> &cpus)
+        : tbb::task_scheduler_observer(arena) {
+#if defined(__linux__)
+        CPU_ZERO(&m_cpus);
+        for (int cpu : cpus)
+            CPU_SET(cpu, &m_cpus);
+#else
+        (void) cpus;
+#endif
+        observe(true);
+    }
+
+    ~NodeObserver() { observe(false); }
+
+    void on_scheduler_entry(bool) {
+#if defined(__linux__)
+        cpu_set_t previous;
+        if (sched_getaffinity(0, sizeof(previous), &previous) == 0) {
+            m_previous.local() = previous;
+            sched_setaffinity(0, sizeof(m_cpus), &m_cpus);
+        }
+        setInterleavedAllocation(false);
+#endif
+    }
+
+    void on_scheduler_exit(bool) {
+#if defined(__linux__)
+        sched_setaffinity(0, sizeof(cpu_set_t), &m_previous.local());
+#endif
+    }
+
+private:
+#if defined(__linux__)
+    cpu_set_t m_cpus;
+    tbb::enumerable_thread_specific<cpu_set_t> m_previous;
+#endif
+};
+
+class ThreadPinning::Observer : public tbb::task_scheduler_observer {
+public:
+    Observer() : m_cpus(getNumaNodes()) {
+        /* Fill the nodes one after the other */
+        for (auto &cpus : m_cpus)
+            m_cpuCount += (int) cpus.size();
+        observe(true);
+    }
+
+    ~Observer() { observe(false); }
+
+    void on_scheduler_entry(bool) {
+#if defined(__linux__)
+        int &cpu = m_cpu.local();
+        if (cpu < 0) {
+            int index = m_next++ % m_cpuCount;
+            for (auto &cpus : m_cpus) {
+                if (index < (int) cpus.size()) {
+                    cpu = cpus[index];
+                    break;
+                }
+                index -= (int) cpus.size();
+            }
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+#endif
+    }
+
+private:
+    std::vector<std::vector<int>> m_cpus;
+    int m_cpuCount = 0;
+    std::atomic<int> m_next{0};
+    tbb::enumerable_thread_specific<int> m_cpu{-1};
+};
+
+ThreadPinning::ThreadPinning() : m_observer(new Observer()) { }
+
+ThreadPinning::~ThreadPinning() { }
+
+struct NumaArenas::Node {
+    int threads;
+    tbb::task_arena arena;
+    std::unique_ptr<NodeObserver> observer;
+    tbb::task_group group;
+
+    Node(const std::vector<int> &cpus) : threads((int) cpus.size()), arena(threads) {
+        arena.initialize();
+        observer.reset(new NodeObserver(arena, cpus));
+    }
+};
+
+NumaArenas::NumaArenas() {
+    for (const std::vector<int> &cpus : getNumaNodes())
+        m_nodes.emplace_back(new Node(cpus));
+}
+
+NumaArenas::~NumaArenas() { }
+
+int NumaArenas::getThreadCount(int node) const {
+    return m_nodes[node]->threads;
+}
+
+void NumaArenas::run(const std::function<void(int)> &func) {
+    /* First hand the function to all arenas, then wait for them */
+    for (int i = 0; i < (int) m_nodes.size(); ++i) {
+        Node &node = *m_nodes[i];
+        node.arena.execute([&node, &func, i] { node.group.run([&func, i] { func(i); }); });
+    }
+    for (auto &node : m_nodes) {
+        Node &n = *node;
+        n.arena.execute([&n] { n.group.wait(); });
+    }
+}
+
+NORI_NAMESPACE_END
@@ -30,8 +30,6 @@ NORI_NAMESPACE_BEGIN
 class WavefrontOBJ : public Mesh {
 public:
     WavefrontOBJ(const PropertyList &propList) : Mesh(propList) {
-        typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
-
         filesystem::path filename =
             getFileResolver()->resolve(propList.getString("filename"));
 
@@ -40,9 +38,34 @@ public:
             throw NoriException("Unable to open OBJ file \"%s\"!", filename);
 
 		bool flipTexCoords = propList.getBoolean("flipTexCoords", true);
+        m_name = filename.str();
+
+        /* Parse the file in the background, while the rest of the scene is loaded */
+        loadAsync([this, flipTexCoords] {
+            try {
+                load(flipTexCoords);
+            } catch (const std::exception &e) {
+                throw NoriException("Error while loading \"%s\": %s", m_name, e.what());
+            }
+        });
+    }
+
+    /// Wait for the loader, which must not outlive any part of the mesh
+    ~WavefrontOBJ() {
+        try {
+            waitUntilLoaded();
+        } catch (...) {
+        }
+    }
+
+private:
+    void load(bool flipTexCoords) {
+        typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
+
+        std::ifstream is(m_name);
+        if (is.fail())
+            throw NoriException("Unable to open OBJ file \"%s\"!", m_name);
 
-        cout << "Loading \"" << filename << "\" .. ";
-        cout.flush();
         Timer timer;
 
         std::vector<Vector3f>   positions;
@@ -126,15 +149,12 @@ public:
                 m_UV.col(i) = texcoords.at(vertices[i].uv-1);
         }
 
-        m_name = filename.str();
-
-		buildSamplingTable();
-
-        cout << "done. (V=" << m_V.cols() << ", F=" << m_F.cols() << ", took "
-             << timer.elapsedString() << " and "
-             << memString(m_F.size() * sizeof(uint32_t) +
-                          sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
-             << ")" << endl;
+        /* A single write, since several meshes may finish at once */
+        cout << tfm::format("Loaded \"%s\" (V=%i, F=%i, took %s and %s)\n", m_name,
+                            m_V.cols(), m_F.cols(), timer.elapsedString(),
+                            memString(m_F.size() * sizeof(uint32_t) +
+                                      sizeof(float) * (m_V.size() + m_N.size() + m_UV.size())))
+             << std::flush;
     }
 
 protected:
@@ -0,0 +1,1108 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/render.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/rfilter.h>
+#include <nori/block.h>
+#include <nori/checkpoint.h>
+#include <nori/numa.h>
+#include <nori/device.h>
+#include <nori/timer.h>
+#include <nori/bitmap.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/stats.h>
+#include <nori/shadowqueue.h>
+#include <nori/wavefront.h>
+#include <nori/gui.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_group.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+#if defined(_WIN32)
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Prints the rendering progress on the console
+ *
+ * Used in headless mode, where there is no preview window. A background
+ * thread periodically reports the fraction of completed work, the current
+ * ray throughput and an estimate of the remaining time. On a terminal, the
+ * status line is updated in place; when the output is redirected to a log
+ * file, a new line is printed every few seconds instead.
+ *
+ * When rendering with a time budget, the progress is measured
+ * against the budget instead of the amount of completed work.
+ */
+class ProgressReporter {
+public:
+    /**
+     * \param label
+     *     Text printed in front of the status line
+     * \param total
+     *     Total units of work (ignored if a time budget is given)
+     * \param timeBudget
+     *     Time budget in milliseconds, or zero
+     */
+    ProgressReporter(const std::string &label, int total, double timeBudget = 0)
+        : m_label(label), m_total(total), m_timeBudget(timeBudget) {
+#if defined(_WIN32)
+        m_interactive = _isatty(_fileno(stdout)) != 0;
+#else
+        m_interactive = isatty(fileno(stdout)) != 0;
+#endif
+        m_lastRays = Statistics::instance().rays.value();
+        m_thread = std::thread([this] { run(); });
+    }
+
+    ~ProgressReporter() { finish(); }
+
+    /// Record that some units of work have been completed
+    void update(int amount = 1) { m_done += amount; }
+
+    /// Print the final status and stop the reporting thread
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished = true;
+        }
+        m_cond.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto interval = m_interactive ? std::chrono::milliseconds(500)
+                                      : std::chrono::milliseconds(10000);
+        while (!m_cond.wait_for(lock, interval, [this] { return m_finished; }))
+            print();
+        print();
+        if (m_interactive)
+            cout << endl;
+    }
+
+    void print() {
+        double elapsed = m_timer.elapsed();
+        int done = m_done;
+        float progress;
+        if (m_timeBudget > 0)
+            progress = (float) std::min(1.0, elapsed / m_timeBudget);
+        else
+            progress = m_total > 0 ? done / (float) m_total : 1.0f;
+
+        /* Ray throughput since the last status update */
+        uint64_t rays = Statistics::instance().rays.value();
+        double lapTime = m_lapTimer.lap();
+        double raysPerSec = lapTime > 0 ? (rays - m_lastRays) * 1000.0 / lapTime : 0.0;
+        m_lastRays = rays;
+
+        std::string eta = "--";
+        if (progress > 0)
+            eta = timeString(elapsed * (1 - progress) / progress);
+
+        std::string work = m_timeBudget > 0 ? tfm::format("%i blocks", done)
+                                            : tfm::format("%i/%i", done, m_total);
+        std::string line = tfm::format(
+            "%s .. %5.1f%% (%s), %.2f Mrays/s, elapsed %s, ETA %s",
+            m_label, progress * 100, work, raysPerSec * 1e-6,
+            timeString(elapsed), eta);
+
+        if (m_interactive)
+            cout << "\r" << line << "\x1b[K";
+        else
+            cout << line << endl;
+        cout.flush();
+    }
+
+    std::string m_label;
+    int m_total;
+    double m_timeBudget;
+    std::atomic<int> m_done{0};
+    bool m_interactive = false;
+    bool m_finished = false;
+    uint64_t m_lastRays = 0;
+    Timer m_timer, m_lapTimer;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+/**
+ * \brief Keeps track of the pixels that still need samples
+ * during adaptive rendering
+ */
+class ActivePixels {
+public:
+    /**
+     * \param offset
+     *     Offset of the rendered region (see \ref getRenderRegion())
+     * \param size
+     *     Size of the rendered region
+     */
+    ActivePixels(const Point2i &offset, const Vector2i &size) : m_offset(offset), m_size(size),
+        m_active((size_t) size.prod(), 1), m_count(size.prod()) { }
+
+    /// Does the given pixel (in image coordinates) need further samples?
+    bool operator()(int x, int y) const {
+        return m_active[(y - m_offset.y()) * m_size.x() + x - m_offset.x()] != 0;
+    }
+
+    /// Does any pixel of the given block need further samples?
+    bool any(const ImageBlock &block) const {
+        const Point2i &offset = block.getOffset();
+        const Vector2i &size = block.getSize();
+        for (int y=0; y<size.y(); ++y)
+            for (int x=0; x<size.x(); ++x)
+                if ((*this)(x + offset.x(), y + offset.y()))
+                    return true;
+        return false;
+    }
+
+    /// Return the number of pixels that still need samples
+    int count() const { return m_count; }
+
+    /**
+     * \brief Retire all pixels whose relative error dropped below
+     * the given threshold and return the number of remaining pixels
+     */
+    int update(const ImageBlock &result, float threshold, uint32_t minSamples) {
+        std::atomic<int> count(0);
+        tbb::parallel_for(0, m_size.y(), [&](int y) {
+            int rowCount = 0;
+            for (int x=0; x<m_size.x(); ++x) {
+                uint8_t &active = m_active[y * m_size.x() + x];
+                if (!active)
+                    continue;
+                const PixelStatistics &stats = result.getStatistics(x, y);
+                if (stats.count >= minSamples && stats.relativeError() < threshold)
+                    active = 0;
+                else
+                    ++rowCount;
+            }
+            count += rowCount;
+        });
+        m_count = count;
+        return m_count;
+    }
+
+private:
+    Point2i m_offset;
+    Vector2i m_size;
+    std::vector<uint8_t> m_active;
+    int m_count;
+};
+
+/**
+ * \brief Records the time spent on the samples of every pixel
+ *
+ * This is used to find the expensive parts of a scene (see
+ * \ref RenderOptions::costMap). The times of all passes and
+ * sample ranges of a pixel are added up.
+ */
+class CostMap {
+public:
+    /**
+     * \param offset
+     *     Offset of the rendered region (see \ref getRenderRegion())
+     * \param size
+     *     Size of the rendered region
+     */
+    CostMap(const Point2i &offset, const Vector2i &size) : m_offset(offset), m_size(size),
+        m_cost(new std::atomic<uint64_t>[(size_t) size.prod()]) {
+        for (int i=0; i<size.prod(); ++i)
+            m_cost[i] = 0;
+    }
+
+    /// Record time (in nanoseconds) spent on a pixel (in image coordinates)
+    void add(int x, int y, uint64_t time) {
+        m_cost[(y - m_offset.y()) * m_size.x() + x - m_offset.x()]
+            .fetch_add(time, std::memory_order_relaxed);
+    }
+
+    /// Return the time (in nanoseconds) spent on a pixel (in image coordinates)
+    uint64_t operator()(int x, int y) const {
+        return m_cost[(y - m_offset.y()) * m_size.x() + x - m_offset.x()];
+    }
+
+    /**
+     * \brief Save the times (in microseconds) of the pixels in the
+     * crop window as an OpenEXR file
+     */
+    void save(const Camera *camera, const std::string &filename, bool padCrop) const {
+        const Point2i &cropOffset = camera->getCropOffset();
+        const Vector2i &cropSize = camera->getCropSize();
+        Point2i dst = padCrop ? cropOffset : Point2i(0, 0);
+
+        Bitmap bitmap(padCrop ? camera->getOutputSize() : cropSize);
+        bitmap.setConstant(Color3f(0.f));
+        for (int y=0; y<cropSize.y(); ++y)
+            for (int x=0; x<cropSize.x(); ++x)
+                bitmap.coeffRef(y + dst.y(), x + dst.x()) =
+                    Color3f((*this)(x + cropOffset.x(), y + cropOffset.y()) * 1e-3f);
+        bitmap.setMetadata("unit", "microseconds");
+        bitmap.save(filename);
+    }
+
+    /// Print the blocks that took the most time
+    void printSummary(int blockSize, int count = 10) const {
+        struct BlockCost {
+            Point2i offset;
+            Vector2i size;
+            uint64_t time;
+        };
+
+        std::vector<BlockCost> blocks;
+        uint64_t total = 0;
+        for (int by=0; by<m_size.y(); by += blockSize) {
+            for (int bx=0; bx<m_size.x(); bx += blockSize) {
+                BlockCost block { m_offset + Vector2i(bx, by),
+                    (m_size - Vector2i(bx, by)).cwiseMin(Vector2i::Constant(blockSize)), 0 };
+                for (int y=0; y<block.size.y(); ++y)
+                    for (int x=0; x<block.size.x(); ++x)
+                        block.time += (*this)(block.offset.x() + x, block.offset.y() + y);
+                total += block.time;
+                blocks.push_back(block);
+            }
+        }
+
+        count = std::min(count, (int) blocks.size());
+        std::partial_sort(blocks.begin(), blocks.begin() + count, blocks.end(),
+            [](const BlockCost &a, const BlockCost &b) { return a.time > b.time; });
+
+        cout << tfm::format("Slowest blocks (%.2f us per pixel on average):",
+            total * 1e-3 / m_size.prod()) << endl;
+        for (int i=0; i<count; ++i) {
+            const BlockCost &b = blocks[i];
+            cout << tfm::format("   %4ix%-4i at %4i,%-4i  %10s  %5.1f%%  (%.2f us per pixel)",
+                b.size.x(), b.size.y(), b.offset.x(), b.offset.y(), timeString(b.time * 1e-6),
+                total > 0 ? 100.0 * b.time / total : 0.0, b.time * 1e-3 / b.size.prod()) << endl;
+        }
+    }
+
+private:
+    Point2i m_offset;
+    Vector2i m_size;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_cost;
+};
+
+/**
+ * \brief Render the pixels of a rectangular region of a block, tracing
+ * the camera rays in coherent batches (see \ref Scene::rayIntersect())
+ *
+ * The parameters are the same as for \ref renderPixels(). The camera
+ * rays of consecutive pixels are sampled first, so that they are traced
+ * together, and are then handed to \ref Integrator::LiPrimary() one by one.
+ * The shadow rays of the batch are traced together as well.
+ */
+static void renderPixelBatches(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                               const std::vector<Point2i> &pixels, const Point2i &regionMin,
+                               const Point2i &regionMax, uint32_t sampleCount,
+                               const ActivePixels *active) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    uint64_t pixelCount = 0;
+
+    Ray3f rays[NORI_RAY_BATCH];
+    Point2f pixelSamples[NORI_RAY_BATCH];
+    Color3f weights[NORI_RAY_BATCH];
+    Color3f radiance[NORI_RAY_BATCH];
+    Intersection its[NORI_RAY_BATCH];
+    bool found[NORI_RAY_BATCH];
+    ShadowQueue shadows;
+    int batchSize = 0;
+
+    auto traceBatch = [&]() {
+        scene->rayIntersect(rays, its, found, batchSize);
+
+        /* Compute the incident radiance. The shadow rays that were
+           queued by the integrator are traced together afterwards */
+        for (int i=0; i<batchSize; ++i)
+            radiance[i] = integrator->LiPrimary(scene, sampler, rays[i],
+                found[i] ? &its[i] : nullptr, shadows, (uint32_t) i);
+        shadows.resolve(scene, radiance);
+
+        /* Store in the image block */
+        for (int i=0; i<batchSize; ++i)
+            block.put(pixelSamples[i], weights[i] * radiance[i]);
+        batchSize = 0;
+    };
+
+    for (const Point2i &pixel : pixels) {
+        int x = pixel.x(), y = pixel.y();
+
+        if ((pixel.array() < regionMin.array()).any() ||
+            (pixel.array() >= regionMax.array()).any() ||
+            (active && !(*active)(x + offset.x(), y + offset.y())))
+            continue;
+
+        for (uint32_t i=0; i<sampleCount; ++i) {
+            Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+            Point2f apertureSample = sampler->next2D();
+
+            /* Sample a ray from the camera */
+            pixelSamples[batchSize] = pixelSample;
+            weights[batchSize] = camera->sampleRay(rays[batchSize], pixelSample, apertureSample);
+            if (++batchSize == NORI_RAY_BATCH)
+                traceBatch();
+        }
+        ++pixelCount;
+    }
+
+    if (batchSize > 0)
+        traceBatch();
+
+    Statistics::instance().samples.add(pixelCount * sampleCount);
+}
+
+/**
+ * \brief Render the pixels of a rectangular region of a block using
+ * the wavefront engine (see \ref Wavefront)
+ *
+ * The parameters are the same as for \ref renderPixels(). The camera
+ * rays are added to the wavefront, which renders its paths whenever
+ * it is full.
+ */
+static void renderPixelWavefront(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                                 Wavefront &wavefront, const std::vector<Point2i> &pixels,
+                                 const Point2i &regionMin, const Point2i &regionMax,
+                                 uint32_t sampleCount, const ActivePixels *active) {
+    const Camera *camera = scene->getCamera();
+
+    Point2i offset = block.getOffset();
+    uint64_t pixelCount = 0;
+
+    for (const Point2i &pixel : pixels) {
+        int x = pixel.x(), y = pixel.y();
+
+        if ((pixel.array() < regionMin.array()).any() ||
+            (pixel.array() >= regionMax.array()).any() ||
+            (active && !(*active)(x + offset.x(), y + offset.y())))
+            continue;
+
+        for (uint32_t i=0; i<sampleCount; ++i) {
+            Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+            Point2f apertureSample = sampler->next2D();
+
+            /* Sample a ray from the camera */
+            Ray3f ray;
+            Color3f weight = camera->sampleRay(ray, pixelSample, apertureSample);
+            wavefront.addPath(pixelSample, ray, weight);
+            if (wavefront.isFull())
+                wavefront.render(scene, sampler, block);
+        }
+        ++pixelCount;
+    }
+
+    if (!wavefront.isEmpty())
+        wavefront.render(scene, sampler, block);
+
+    Statistics::instance().samples.add(pixelCount * sampleCount);
+}
+
+/**
+ * \brief Render the pixels of a rectangular region of a block
+ *
+ * \param pixels
+ *     Pixel positions within a block in the order in which
+ *     they are rendered (see \ref traverseGrid())
+ * \param regionMin
+ *     Upper left corner of the region (relative to the block offset)
+ * \param regionMax
+ *     Lower right corner of the region (exclusive)
+ * \param packets
+ *     Trace the camera rays in batches if the integrator supports
+ *     it and no cost map is recorded (see \ref renderPixelBatches())
+ * \param wavefront
+ *     Use the wavefront engine unless a cost map is recorded (only
+ *     passed for integrators that support it)
+ */
+static void renderPixels(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                         const std::vector<Point2i> &pixels, const Point2i &regionMin,
+                         const Point2i &regionMax, uint32_t sampleCount,
+                         const ActivePixels *active, CostMap *costMap, bool packets,
+                         Wavefront *wavefront) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    if (wavefront && !costMap) {
+        renderPixelWavefront(scene, sampler, block, *wavefront, pixels, regionMin,
+                             regionMax, sampleCount, active);
+        return;
+    }
+
+    if (packets && !costMap && integrator->usesPrimaryHits()) {
+        renderPixelBatches(scene, sampler, block, pixels, regionMin, regionMax,
+                           sampleCount, active);
+        return;
+    }
+
+    Point2i offset = block.getOffset();
+    uint64_t pixelCount = 0;
+
+    /* For each pixel and pixel sample sample */
+    for (const Point2i &pixel : pixels) {
+        int x = pixel.x(), y = pixel.y();
+
+        /* Skip pixels outside of the region (e.g. in partial blocks at
+           the image border), and pixels that have already converged */
+        if ((pixel.array() < regionMin.array()).any() ||
+            (pixel.array() >= regionMax.array()).any() ||
+            (active && !(*active)(x + offset.x(), y + offset.y())))
+            continue;
+
+        std::chrono::steady_clock::time_point start;
+        if (costMap)
+            start = std::chrono::steady_clock::now();
+
+        for (uint32_t i=0; i<sampleCount; ++i) {
+            Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+            Point2f apertureSample = sampler->next2D();
+
+            /* Sample a ray from the camera */
+            Ray3f ray;
+            Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+            /* Compute the incident radiance */
+            value *= integrator->Li(scene, sampler, ray);
+
+            /* Store in the image block */
+            block.put(pixelSample, value);
+        }
+        ++pixelCount;
+
+        if (costMap)
+            costMap->add(x + offset.x(), y + offset.y(), (uint64_t)
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+    }
+
+    Statistics::instance().samples.add(pixelCount * sampleCount);
+}
+
+void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                 uint32_t sampleIndex, uint32_t sampleCount) {
+    std::vector<Point2i> pixels = traverseGrid(block.getSize(), scene->getPixelOrder());
+    block.clear();
+    sampler->prepare(block, sampleIndex);
+    renderPixels(scene, sampler, block, pixels, Point2i(0, 0), block.getSize(),
+                 sampleCount, nullptr, nullptr, true, nullptr);
+}
+
+/**
+ * \brief Choose the size of the blocks that are rendered in parallel
+ *
+ * Blocks should contain enough samples that clearing and merging them
+ * is cheap compared to rendering them, but there should also be plenty
+ * of blocks per thread so that the load is balanced well.
+ */
+static int chooseBlockSize(const Vector2i &size, uint32_t passSamples, int threads) {
+    auto blockCount = [&](int blockSize) {
+        return ((size.array() + blockSize - 1) / blockSize).prod();
+    };
+
+    int blockSize = 64;
+    while (blockSize > 8 && blockCount(blockSize) < 16 * threads &&
+           (blockSize / 2) * (blockSize / 2) * passSamples >= 4096)
+        blockSize /= 2;
+    return blockSize;
+}
+
+/**
+ * \brief Choose into how many sample ranges the blocks are split
+ *
+ * Small images don't have enough blocks to keep all threads busy. In
+ * that case, the samples of a block are split into ranges that are
+ * rendered in parallel and then merged into the image one by one.
+ * Every range should still contain enough samples to amortize the
+ * cost of clearing and merging the block.
+ */
+static uint32_t chooseSampleSplits(int blockCount, int blockSize, uint32_t passSamples,
+                                   int threads) {
+    uint32_t splits = 1;
+    while (blockCount * (int) splits < 16 * threads && passSamples / (2 * splits) > 0 &&
+           (uint64_t) blockSize * blockSize * (passSamples / (2 * splits)) >= 4096)
+        splits *= 2;
+    return splits;
+}
+
+/**
+ * \brief Renders the blocks of a pass on behalf of the worker threads
+ *
+ * Every thread keeps its own image block and sampler, which are reused
+ * for all blocks it renders. Larger blocks are rendered one quadrant at
+ * a time. Once the block generator has run dry and a block takes longer
+ * than the average block, its remaining quadrants are split off so that
+ * idle threads can pick them up, rather than waiting for a few slow
+ * blocks at the end of a pass.
+ */
+class BlockRenderer {
+public:
+    BlockRenderer(const Scene *scene, ImageBlock &result, BlockGenerator &generator,
+                  int blockSize, ETraversalOrder pixelOrder, bool adaptive, CostMap *costMap,
+                  bool packets, bool wavefront, int sortBatch)
+        : m_scene(scene), m_result(result), m_generator(generator),
+          m_blockSize(blockSize), m_adaptive(adaptive), m_costMap(costMap), m_packets(packets),
+          m_wavefront(wavefront && scene->getIntegrator()->supportsWavefront()),
+          m_sortBatch(sortBatch),
+          m_pixels(traverseGrid(Vector2i::Constant(blockSize), pixelOrder)) { }
+
+    ~BlockRenderer() {
+        for (ThreadState &state : m_threads) {
+            delete state.block;
+            delete state.sampler;
+            delete state.wavefront;
+        }
+    }
+
+    /**
+     * \brief Start a new pass that adds the given samples to every pixel
+     *
+     * \param sampleSplits
+     *     Number of sample ranges per block that are rendered in
+     *     parallel (see \ref chooseSampleSplits())
+     */
+    void beginPass(uint32_t sampleIndex, uint32_t sampleCount, uint32_t sampleSplits,
+                   const ActivePixels *active) {
+        m_sampleIndex = sampleIndex;
+        m_sampleCount = sampleCount;
+        m_sampleSplits = std::max(1u, std::min(sampleSplits, sampleCount));
+        m_active = active;
+        m_generator.reset();
+    }
+
+    /// Render the next block of the current pass
+    void renderNext() {
+        Point2i offset;
+        Vector2i size;
+        if (!m_generator.next(offset, size))
+            return;
+
+        Timer timer;
+        if (m_sampleSplits == 1) {
+            renderRegion(offset, size, m_sampleIndex, m_sampleCount);
+        } else {
+            /* Offer all but the first sample range to idle threads. Each
+               range starts at a different sample index, which gives it an
+               independent sample sequence */
+            tbb::task_group group;
+            for (uint32_t i=m_sampleSplits-1; i>0; --i) {
+                uint32_t begin = m_sampleIndex + (uint32_t) ((uint64_t) m_sampleCount * i / m_sampleSplits),
+                         end = m_sampleIndex + (uint32_t) ((uint64_t) m_sampleCount * (i+1) / m_sampleSplits);
+                group.run([this, offset, size, begin, end] {
+                    renderRegion(offset, size, begin, end - begin);
+                });
+            }
+            renderRegion(offset, size, m_sampleIndex, m_sampleCount / m_sampleSplits);
+            group.wait();
+        }
+        m_blockTime += (uint64_t) (timer.elapsed() * 1000);
+        ++m_blocksDone;
+    }
+
+private:
+    struct ThreadState {
+        ImageBlock *block = nullptr;
+        Sampler *sampler = nullptr;
+        Wavefront *wavefront = nullptr;
+    };
+
+    /// Return the image block, sampler and wavefront of the current thread
+    ThreadState &threadState() {
+        ThreadState &state = m_threads.local();
+        if (!state.block) {
+            state.block = new ImageBlock(Vector2i::Constant(m_blockSize),
+                m_scene->getCamera()->getReconstructionFilter());
+            if (m_adaptive)
+                state.block->enableStatistics();
+            state.sampler = m_scene->getSampler()->clone().release();
+            if (m_wavefront) {
+                state.wavefront = new Wavefront();
+                state.wavefront->setSortBatch((size_t) m_sortBatch);
+            }
+        }
+        return state;
+    }
+
+    /// Should a block that has been rendering for the given time (in ms) be split?
+    bool shouldSplit(double elapsed) const {
+        uint64_t blocksDone = m_blocksDone;
+        return m_generator.isEmpty() && blocksDone > 0 &&
+               elapsed * 1000 > m_blockTime / blocksDone;
+    }
+
+    /// Render the given samples of a region and merge it into the result
+    void renderRegion(const Point2i &offset, const Vector2i &size,
+                      uint32_t sampleIndex, uint32_t sampleCount) {
+        ThreadState &state = threadState();
+        ImageBlock &block = *state.block;
+        block.setOffset(offset);
+        block.setSize(size);
+
+        if (m_active && !m_active->any(block))
+            return;
+
+        block.clear();
+        Timer timer;
+        tbb::task_group group;
+        renderQuadrants(state, Point2i(0, 0), size, sampleIndex, sampleCount, timer, group);
+
+        /* The image block has been processed. Now add it to the "big"
+           block that represents the entire image. This must happen
+           before waiting for split off regions, since this thread
+           may render them itself using the same image block */
+        m_result.put(block);
+        group.wait();
+    }
+
+    /**
+     * \brief Render the part [regionMin, regionMax) of the block of the
+     * current thread
+     *
+     * Regions of 16x16 pixels and more are rendered quadrant by quadrant,
+     * and once the block takes longer than average, the remaining ones are
+     * split off as regions of their own. The sampler is prepared with the
+     * offset of every quadrant that isn't subdivided further, so that each
+     * pixel receives the same samples no matter when (or whether) the
+     * block is split.
+     */
+    void renderQuadrants(ThreadState &state, const Point2i &regionMin,
+                         const Point2i &regionMax, uint32_t sampleIndex,
+                         uint32_t sampleCount, const Timer &timer,
+                         tbb::task_group &group) {
+        ImageBlock &block = *state.block;
+        Vector2i size = regionMax - regionMin;
+        if (size.minCoeff() < 16) {
+            state.sampler->prepare(block.getOffset() + regionMin, sampleIndex);
+            renderPixels(m_scene, state.sampler, block, m_pixels, regionMin,
+                         regionMax, sampleCount, m_active, m_costMap, m_packets,
+                         state.wavefront);
+            return;
+        }
+
+        Point2i half = regionMin + size / 2;
+        Point2i quadMin[4], quadMax[4];
+        for (int i=0; i<4; ++i) {
+            quadMin[i] = Point2i(i & 1 ? half.x() : regionMin.x(), i & 2 ? half.y() : regionMin.y());
+            quadMax[i] = Point2i(i & 1 ? regionMax.x() : half.x(), i & 2 ? regionMax.y() : half.y());
+        }
+
+        for (int i=0; i<4; ++i) {
+            if (i > 0 && shouldSplit(timer.elapsed())) {
+                for (int j=i; j<4; ++j) {
+                    Point2i subOffset = block.getOffset() + quadMin[j];
+                    Vector2i subSize = quadMax[j] - quadMin[j];
+                    group.run([this, subOffset, subSize, sampleIndex, sampleCount] {
+                        renderRegion(subOffset, subSize, sampleIndex, sampleCount);
+                    });
+                }
+                return;
+            }
+            renderQuadrants(state, quadMin[i], quadMax[i], sampleIndex, sampleCount,
+                            timer, group);
+        }
+    }
+
+    const Scene *m_scene;
+    ImageBlock &m_result;
+    BlockGenerator &m_generator;
+    int m_blockSize;
+    bool m_adaptive;
+    CostMap *m_costMap;
+    bool m_packets;
+    bool m_wavefront;
+    int m_sortBatch;
+    std::vector<Point2i> m_pixels;
+    tbb::enumerable_thread_specific<ThreadState> m_threads;
+    uint32_t m_sampleIndex = 0;
+    uint32_t m_sampleCount = 0;
+    uint32_t m_sampleSplits = 1;
+    const ActivePixels *m_active = nullptr;
+    std::atomic<uint64_t> m_blockTime{0};  ///< Total time spent on blocks (in us)
+    std::atomic<uint64_t> m_blocksDone{0};
+};
+
+/// Return the filename of the scene description without its extension
+static std::string baseName(const std::string &filename) {
+    std::string result = filename;
+    size_t lastdot = result.find_last_of(".");
+    if (lastdot != std::string::npos)
+        result.erase(lastdot, std::string::npos);
+    return result;
+}
+
+void getRenderRegion(const Scene *scene, Point2i &offset, Vector2i &size) {
+    const Camera *camera = scene->getCamera();
+    int borderSize = (int) std::ceil(camera->getReconstructionFilter()->getRadius() - 0.5f);
+
+    Point2i regionMin = camera->getCropOffset() - Vector2i::Constant(borderSize);
+    Point2i regionMax = camera->getCropOffset() + camera->getCropSize()
+        + Vector2i::Constant(borderSize);
+    offset = regionMin.cwiseMax(Point2i(0, 0));
+    size = regionMax.cwiseMin(camera->getOutputSize()) - offset;
+}
+
+void saveImage(const Scene *scene, const ImageBlock &image, const std::string &filename,
+               const RenderOptions &options, uint32_t sampleCount,
+               double renderTime) {
+    /* Extract the crop window from the rendered region, which
+       also contains the border of the reconstruction filter */
+    const Camera *camera = scene->getCamera();
+    const Point2i &cropOffset = camera->getCropOffset();
+    const Vector2i &cropSize = camera->getCropSize();
+    Vector2i outputSize = options.padCrop ? camera->getOutputSize() : cropSize;
+    Point2i src = cropOffset - image.getOffset() + Vector2i::Constant(image.getBorderSize());
+    Point2i dst = options.padCrop ? cropOffset : Point2i(0, 0);
+
+    ImageBlock output(outputSize, nullptr);
+    output.clear();
+    output.block(dst.y(), dst.x(), cropSize.y(), cropSize.x()) =
+        image.block(src.y(), src.x(), cropSize.y(), cropSize.x());
+
+    /* Turn the rendered image block into a properly
+       normalized bitmap and save it using the OpenEXR format */
+    std::unique_ptr<Bitmap> bitmap(output.toBitmap());
+    bitmap->setMetadata("spp", std::to_string(sampleCount));
+    bitmap->setMetadata("seed", std::to_string(options.seed));
+    bitmap->setMetadata("renderTime", timeString(renderTime, true));
+    if (cropSize != camera->getOutputSize())
+        bitmap->setMetadata("cropWindow", tfm::format("%i %i %i %i",
+            cropOffset.x(), cropOffset.y(), cropSize.x(), cropSize.y()));
+    bitmap->save(baseName(filename) + ".exr");
+
+    if (options.weightedOutput)
+        output.saveWeighted(baseName(filename) + ".weighted.exr", bitmap->getMetadata());
+}
+
+void render(Scene *scene, const std::string &filename, const RenderOptions &options) {
+    const Camera *camera = scene->getCamera();
+    scene->getIntegrator()->preprocess(scene);
+
+    /* Allocate memory for the rendered part of the image and clear it */
+    Point2i outputOffset;
+    Vector2i outputSize;
+    getRenderRegion(scene, outputOffset, outputSize);
+    ImageBlock result(outputSize, camera->getReconstructionFilter());
+    result.setOffset(outputOffset);
+    bool adaptive = scene->getAdaptiveThreshold() > 0;
+    if (adaptive)
+        result.enableStatistics();
+
+    /* Split the pixel samples into passes. Without progressive
+       rendering, there is a single pass that takes all samples.
+       With a time budget, passes are rendered until the budget is
+       used up, regardless of the sampler's sample count. */
+    double timeBudget = 1000.0 * (options.timeBudget > 0 ? options.timeBudget
+                                                         : scene->getTimeBudget());
+    uint32_t sampleCount = (uint32_t) scene->getSampler()->getSampleCount();
+    uint32_t passSampleCount = sampleCount;
+    uint32_t passCount = 1;
+    if (timeBudget > 0) {
+        passSampleCount = scene->getPassSampleCount();
+        passCount = NORI_SEED_SAMPLES / passSampleCount;
+    } else if (scene->isProgressive() || options.checkpointInterval > 0 || options.resume) {
+        /* Checkpoints are taken between passes */
+        passSampleCount = std::min(scene->getPassSampleCount(), sampleCount);
+        passCount = (sampleCount + passSampleCount - 1) / passSampleCount;
+    }
+
+    /* Every seed has its own range of sample indices */
+    if (sampleCount > NORI_SEED_SAMPLES && timeBudget <= 0)
+        throw NoriException("At most %i samples per pixel are supported!", NORI_SEED_SAMPLES);
+    uint32_t firstSample = options.seed * NORI_SEED_SAMPLES;
+
+    std::unique_ptr<ActivePixels> active;
+    if (adaptive)
+        active.reset(new ActivePixels(outputOffset, outputSize));
+
+    /* Create a block generator (i.e. a work scheduler) */
+    int threadCount = getThreadCount();
+    int blockSize = scene->getBlockSize();
+    if (blockSize == 0)
+        blockSize = chooseBlockSize(outputSize, passSampleCount, threadCount);
+    ETraversalOrder blockOrder = options.blockOrder.empty() ? scene->getBlockOrder()
+                                                            : toTraversalOrder(options.blockOrder);
+
+    /* In NUMA mode, every node renders a horizontal strip of the image
+       (proportional to its number of cores) using its own threads */
+    std::unique_ptr<NumaArenas> arenas;
+    if (options.numa) {
+        arenas.reset(new NumaArenas());
+        if (arenas->getNodeCount() == 1) {
+            arenas.reset();
+            if (!options.quiet)
+                cout << "Only a single NUMA node was found, using the default scheduler" << endl;
+        }
+    }
+    int stripCount = arenas ? arenas->getNodeCount() : 1;
+    std::vector<int> stripThreads(stripCount, 1);
+    int totalThreads = 0;
+    for (int i=0; i<stripCount; ++i) {
+        if (arenas)
+            stripThreads[i] = arenas->getThreadCount(i);
+        totalThreads += stripThreads[i];
+    }
+    std::vector<int> stripRows(stripCount + 1, 0);
+    int blockRows = (outputSize.y() + blockSize - 1) / blockSize, threadSum = 0;
+    for (int i=0; i<stripCount; ++i) {
+        threadSum += stripThreads[i];
+        stripRows[i+1] = std::min(outputSize.y(),
+            blockSize * (int) ((int64_t) blockRows * threadSum / totalThreads));
+    }
+
+    std::vector<std::unique_ptr<BlockGenerator>> generators;
+    int blockCount = 0;
+    for (int i=0; i<stripCount; ++i) {
+        generators.emplace_back(new BlockGenerator(
+            Vector2i(outputSize.x(), stripRows[i+1] - stripRows[i]), blockSize, blockOrder,
+            outputOffset + Vector2i(0, stripRows[i])));
+        blockCount += generators.back()->getBlockCount();
+    }
+    uint32_t sampleSplits = chooseSampleSplits(blockCount, blockSize, passSampleCount, threadCount);
+
+    /* The rows of a strip are first touched (and hence allocated)
+       by the node that renders it */
+    if (arenas) {
+        arenas->run([&](int strip) {
+            int borderSize = result.getBorderSize();
+            int first = strip == 0 ? 0 : stripRows[strip] + borderSize,
+                last = strip == stripCount - 1 ? (int) result.rows() : stripRows[strip+1] + borderSize;
+            result.block(first, 0, last - first, result.cols()).setConstant(Color4f());
+        });
+    }
+    result.clear();
+
+    /* Order in which the pixels within each block are rendered */
+    ETraversalOrder pixelOrder = options.pixelOrder.empty() ? scene->getPixelOrder()
+                                                            : toTraversalOrder(options.pixelOrder);
+    std::unique_ptr<CostMap> costMap;
+    if (options.costMap)
+        costMap.reset(new CostMap(outputOffset, outputSize));
+    std::vector<std::unique_ptr<BlockRenderer>> renderers;
+    for (auto &generator : generators)
+        renderers.emplace_back(new BlockRenderer(scene, result, *generator, blockSize,
+                                                 pixelOrder, adaptive, costMap.get(),
+                                                 options.packets, options.wavefront,
+                                                 options.sortBatch));
+
+    /* Continue from the last checkpoint of an interrupted rendering */
+    std::string checkpointName = baseName(filename) + ".checkpoint";
+    std::unique_ptr<CheckpointWriter> checkpointer;
+    CheckpointInfo resumed;
+    if (options.checkpointInterval > 0 || options.resume) {
+        uint64_t sceneHash = hashFile(filename);
+        if (options.resume) {
+            if (loadCheckpoint(checkpointName, sceneHash, result, resumed)) {
+                if (resumed.passSampleCount != passSampleCount)
+                    throw NoriException("The checkpoint \"%s\" was rendered with %i samples per "
+                        "pass (expected %i)!", checkpointName, resumed.passSampleCount, passSampleCount);
+                if (resumed.seed != options.seed)
+                    throw NoriException("The checkpoint \"%s\" was rendered with seed %i "
+                        "(expected %i)!", checkpointName, resumed.seed, options.seed);
+                if (!options.quiet)
+                    cout << "Resuming from \"" << checkpointName << "\" (" << resumed.passes
+                         << " passes, " << resumed.samples << " spp)" << endl;
+                if (active && resumed.samples >= scene->getAdaptiveMinSamples())
+                    active->update(result, scene->getAdaptiveThreshold(),
+                                   scene->getAdaptiveMinSamples());
+            } else if (!options.quiet) {
+                cout << "No checkpoint \"" << checkpointName << "\" found, starting from scratch" << endl;
+            }
+        }
+        if (options.checkpointInterval > 0)
+            checkpointer.reset(new CheckpointWriter(checkpointName, sceneHash));
+    }
+
+    auto renderImage = [&] {
+        uint64_t raysBefore = Statistics::instance().rays.value();
+        uint64_t samplesBefore = Statistics::instance().samples.value();
+
+        std::unique_ptr<ProgressReporter> progress;
+        if (options.quiet) {
+            /* No output */
+        } else if (options.headless) {
+            progress.reset(new ProgressReporter("Rendering", timeBudget > 0 ? 0
+                : blockCount * (int) (passCount - std::min(resumed.passes, passCount)),
+                timeBudget > 0 ? std::max(timeBudget - resumed.elapsed, 1.0) : 0.0));
+        } else {
+            cout << "Rendering .. ";
+            cout.flush();
+        }
+        Timer timer, checkpointTimer;
+        auto elapsedTotal = [&] { return resumed.elapsed + timer.elapsed(); };
+
+        uint32_t pass = resumed.passes, samplesTaken = resumed.samples;
+        while (pass < passCount) {
+            uint32_t sampleIndex = samplesTaken;
+            uint32_t passSamples = passSampleCount;
+            if (timeBudget <= 0)
+                passSamples = std::min(passSampleCount, sampleCount - sampleIndex);
+            for (auto &renderer : renderers)
+                renderer->beginPass(firstSample + sampleIndex, passSamples, sampleSplits,
+                                    active.get());
+
+            auto renderStrip = [&](int strip) {
+                tbb::blocked_range<int> range(0, generators[strip]->getBlockCount());
+
+                auto map = [&](const tbb::blocked_range<int> &range) {
+                    for (int i=range.begin(); i<range.end(); ++i) {
+                        /* Render the next block and add it to the
+                           "big" block that represents the entire image */
+                        renderers[strip]->renderNext();
+
+                        if (progress)
+                            progress->update();
+                    }
+                };
+
+                /// Uncomment the following line for single threaded rendering
+                // map(range);
+
+                /// Default: parallel rendering
+                tbb::parallel_for(range, map);
+            };
+
+            if (arenas)
+                arenas->run(renderStrip);
+            else
+                EmbreeDevice::arena().execute([&] { renderStrip(0); });
+            ++pass;
+            samplesTaken += passSamples;
+
+            /* Stop sampling pixels whose noise is low enough */
+            if (active && samplesTaken >= scene->getAdaptiveMinSamples()) {
+                int remaining = active->update(result, scene->getAdaptiveThreshold(),
+                                               scene->getAdaptiveMinSamples());
+                if (remaining == 0)
+                    break;
+            }
+
+            /* Only start another pass if it is expected to
+               complete before the time budget runs out */
+            if (timeBudget > 0) {
+                double elapsed = elapsedTotal();
+                if (elapsed + elapsed / pass > timeBudget)
+                    break;
+            }
+
+            /* The image is consistent between passes. It is copied here
+               and written to disk while the next pass is rendered */
+            if (checkpointer && pass < passCount &&
+                checkpointTimer.elapsed() > 1000.0 * options.checkpointInterval) {
+                CheckpointInfo info;
+                info.passes = pass;
+                info.samples = samplesTaken;
+                info.passSampleCount = passSampleCount;
+                info.elapsed = elapsedTotal();
+                info.seed = options.seed;
+                checkpointer->write(result, info);
+                checkpointTimer.reset();
+            }
+        }
+
+        double elapsed = elapsedTotal();
+        std::string summary = "took " + timeString(elapsed);
+        if (timeBudget > 0)
+            summary += tfm::format(", %i passes, %i spp", pass, samplesTaken);
+        else if (passCount > 1)
+            summary += tfm::format(", %i/%i passes", pass, passCount);
+        if (adaptive) {
+            uint64_t samples = Statistics::instance().samples.value() - samplesBefore;
+            summary += tfm::format(", %.1f spp on average, %i pixels unconverged",
+                samples / (double) outputSize.prod(), active->count());
+        }
+
+        if (progress) {
+            progress->finish();
+            uint64_t rays = Statistics::instance().rays.value() - raysBefore;
+            cout << "Rendering done. (" << summary << ", "
+                 << tfm::format("%.2f", timer.elapsed() > 0 ? rays / (timer.elapsed() * 1e3) : 0.0)
+                 << " Mrays/s on average)" << endl;
+        } else if (!options.quiet) {
+            cout << "done. (" << summary << ")" << endl;
+        }
+
+        if (costMap && !options.quiet)
+            costMap->printSummary(blockSize);
+
+        if (!options.writeOutput)
+            return;
+
+        saveImage(scene, result, filename, options, samplesTaken, elapsed);
+        if (costMap)
+            costMap->save(camera, baseName(filename) + ".cost.exr", options.padCrop);
+
+        /* The checkpoint is obsolete once the image has been saved */
+        if (checkpointer) {
+            checkpointer->flush();
+            std::remove(checkpointName.c_str());
+        }
+    };
+
+    if (options.headless || options.quiet) {
+        /* No preview window: use every core for rendering */
+        renderImage();
+        return;
+    }
+
+    /* Create a window that visualizes the partially rendered result */
+    nanogui::init();
+    NoriScreen *screen = new NoriScreen(result);
+
+    /* Do the following in parallel and asynchronously */
+    std::thread render_thread(renderImage);
+
+    /* Enter the application main loop */
+    nanogui::mainloop();
+
+    /* Shut down the user interface */
+    render_thread.join();
+
+    delete screen;
+    nanogui::shutdown();
+}
+
+bool isDisplayAvailable() {
+#if defined(_WIN32) || defined(__APPLE__)
+    return true;
+#else
+    const char *x11 = getenv("DISPLAY");
+    const char *wayland = getenv("WAYLAND_DISPLAY");
+    return (x11 && *x11) || (wayland && *wayland);
+#endif
+}
+
+NORI_NAMESPACE_END
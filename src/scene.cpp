@@ -22,34 +22,93 @@
 #include <nori/sampler.h>
 #include <nori/camera.h>
 #include <nori/emitter.h>
+#include <nori/instance.h>
+#include <nori/sphereset.h>
 #include <nori/device.h>
+#include <nori/stats.h>
+#include <nori/timer.h>
 
 NORI_NAMESPACE_BEGIN
 
-Scene::Scene(const PropertyList &) {
+/// Parse a comma-separated list of Embree scene flags
+static RTCSceneFlags toSceneFlags(const std::string &names) {
+	int flags = RTC_SCENE_FLAG_NONE;
+	for (auto &name : tokenize(names)) {
+		if (name == "robust")
+			flags |= RTC_SCENE_FLAG_ROBUST;
+		else if (name == "compact")
+			flags |= RTC_SCENE_FLAG_COMPACT;
+		else if (name == "dynamic")
+			flags |= RTC_SCENE_FLAG_DYNAMIC;
+		else if (name != "none")
+			throw NoriException("Unknown scene flag \"%s\" (expected "
+			                    "\"robust\", \"compact\", \"dynamic\" or \"none\")", name);
+	}
+	return (RTCSceneFlags)flags;
+}
+
+static RTCBuildQuality toBuildQuality(const std::string &name) {
+	if (name == "low")
+		return RTC_BUILD_QUALITY_LOW;
+	else if (name == "medium")
+		return RTC_BUILD_QUALITY_MEDIUM;
+	else if (name == "high")
+		return RTC_BUILD_QUALITY_HIGH;
+	else if (name == "refit")
+		return RTC_BUILD_QUALITY_REFIT;
+	throw NoriException("Unknown build quality \"%s\" (expected "
+	                    "\"low\", \"medium\", \"high\" or \"refit\")", name);
+}
+
+/// Parse the name of an acceleration data structure (true: Embree)
+static bool toUseEmbree(const std::string &name) {
+	if (name == "embree")
+		return true;
+	else if (name == "bvh")
+		return false;
+	throw NoriException("Unknown acceleration data structure \"%s\" (expected "
+	                    "\"embree\" or \"bvh\")", name);
+}
+
+/// Commit an Embree scene in the task arena of the renderer
+static void commitScene(RTCScene scene) {
+	EmbreeDevice::arena().execute([scene] { rtcCommitScene(scene); });
+}
+
+Scene::Scene(const PropertyList &props) {
+	EmbreeDevice::setSceneConfig(props.getString("embreeConfig", ""));
 	m_accel = new Accel();
+	m_useEmbree = toUseEmbree(props.getString("accel", "embree"));
+
+	m_progressive = props.getBoolean("progressive", false);
+	m_passSampleCount = (uint32_t)std::max(1, props.getInteger("passSampleCount", 4));
+	m_adaptiveThreshold = std::max(0.0f, props.getFloat("adaptiveThreshold", 0.0f));
+	m_adaptiveMinSamples = (uint32_t)std::max(2, props.getInteger("adaptiveMinSamples", 16));
+	m_timeBudget = std::max(0.0f, props.getFloat("timeBudget", 0.0f));
+	m_blockSize = std::max(0, props.getInteger("blockSize", 0));
+	m_blockOrder = toTraversalOrder(props.getString("blockOrder", "spiral"));
+	m_pixelOrder = toTraversalOrder(props.getString("pixelOrder", "scanline"));
+	m_sceneFlags = toSceneFlags(props.getString("sceneFlags", "robust"));
+	m_buildQuality = toBuildQuality(props.getString("buildQuality", "medium"));
 }
 
 Scene::~Scene() {
+	// the BVHs refer to the accel and the data of the shapes
+	release();
+
 	delete m_accel;
 	delete m_sampler;
 	delete m_camera;
 	delete m_integrator;
 
 	for (auto p : m_shapes) delete p;
+	for (auto p : m_instances) delete p;
+	for (auto p : m_groups) delete p;
 	for (auto p : m_emitters) delete p;
-
-	if (m_scene) {
-		rtcReleaseScene(m_scene);
-	}
 }
 
-bool Scene::rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const {
-	RTCIntersectContext context;
-	rtcInitIntersectContext(&context);
-
-	// ray initialization
-	RTCRayHit rayhit;
+/// Convert a ray into Embree's representation
+static void initRayHit(const Ray3f &ray, RTCRayHit &rayhit) {
 	rayhit.ray.org_x = ray.o.x();
 	rayhit.ray.org_y = ray.o.y();
 	rayhit.ray.org_z = ray.o.z();
@@ -58,11 +117,31 @@ bool Scene::rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) co
 	rayhit.ray.dir_z = ray.d.z();
 	rayhit.ray.tnear = ray.mint;
 	rayhit.ray.tfar = ray.maxt;
+	rayhit.ray.mask = 0xFFFFFFFF;
 	rayhit.ray.flags = 0;
 	rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+	rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+}
+
+bool Scene::rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const {
+	Statistics::instance().rays.add();
+
+	if (!m_useEmbree) {
+		if (shadowRay)
+			Statistics::instance().shadowRays.add();
+		return m_accel->rayIntersect(ray, its, shadowRay);
+	}
+
+	RTCIntersectContext context;
+	rtcInitIntersectContext(&context);
+
+	// ray initialization
+	RTCRayHit rayhit;
+	initRayHit(ray, rayhit);
 
 	// ray query
 	if (shadowRay) {
+		Statistics::instance().shadowRays.add();
 		rtcOccluded1(m_scene, &context, &rayhit.ray);
 		return rayhit.ray.tfar != ray.maxt;
 	}
@@ -70,19 +149,96 @@ bool Scene::rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) co
 		rtcIntersect1(m_scene, &context, &rayhit);
 	}
 
-	auto &hit = rayhit.hit;
-	if (hit.geomID != RTC_INVALID_GEOMETRY_ID) {
-		m_shapeIDs.at(hit.geomID).shape->setHitInformation(ray, rayhit.ray.tfar, rayhit.hit, its);
+	if (rayhit.hit.geomID != RTC_INVALID_GEOMETRY_ID) {
+		setHitInformation(ray, rayhit, its);
 		return true;
 	}
 
 	return false;
 }
 
-void Scene::activate() {
-	//m_accel->build();
-	// use Embree instead
+void Scene::rayIntersect(const Ray3f *rays, Intersection *its, bool *found, size_t count,
+                         bool coherent) const {
+	Statistics::instance().rays.add(count);
+
+	if (!m_useEmbree) {
+		for (size_t i = 0; i < count; ++i)
+			found[i] = m_accel->rayIntersect(rays[i], its[i], false);
+		return;
+	}
+
+	/* Coherent rays are traced in packets instead of one after the other */
+	RTCIntersectContext context;
+	rtcInitIntersectContext(&context);
+	if (coherent)
+		context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+
+	RTCRayHit rayhits[NORI_RAY_BATCH];
+	for (size_t start = 0; start < count; start += NORI_RAY_BATCH) {
+		unsigned int n = (unsigned int) std::min(count - start, (size_t) NORI_RAY_BATCH);
+		for (unsigned int i = 0; i < n; ++i)
+			initRayHit(rays[start + i], rayhits[i]);
+
+		rtcIntersect1M(m_scene, &context, rayhits, n, sizeof(RTCRayHit));
+
+		for (unsigned int i = 0; i < n; ++i) {
+			found[start + i] = rayhits[i].hit.geomID != RTC_INVALID_GEOMETRY_ID;
+			if (found[start + i])
+				setHitInformation(rays[start + i], rayhits[i], its[start + i]);
+		}
+	}
+}
+
+void Scene::rayOccluded(const Ray3f *rays, bool *occluded, size_t count) const {
+	Statistics::instance().rays.add(count);
+	Statistics::instance().shadowRays.add(count);
+
+	if (!m_useEmbree) {
+		Intersection its; /* Unused */
+		for (size_t i = 0; i < count; ++i)
+			occluded[i] = m_accel->rayIntersect(rays[i], its, true);
+		return;
+	}
+
+	RTCIntersectContext context;
+	rtcInitIntersectContext(&context);
+
+	RTCRayHit rayhits[NORI_RAY_BATCH];
+	for (size_t start = 0; start < count; start += NORI_RAY_BATCH) {
+		unsigned int n = (unsigned int) std::min(count - start, (size_t) NORI_RAY_BATCH);
+		for (unsigned int i = 0; i < n; ++i)
+			initRayHit(rays[start + i], rayhits[i]);
+
+		/* Occluded rays have their tfar set to -inf */
+		rtcOccluded1M(m_scene, &context, &rayhits[0].ray, n, sizeof(RTCRayHit));
 
+		for (unsigned int i = 0; i < n; ++i)
+			occluded[start + i] = rayhits[i].ray.tfar != rays[start + i].maxt;
+	}
+}
+
+void Scene::setHitInformation(const Ray3f &ray, const RTCRayHit &rayhit, Intersection &its) const {
+	auto &hit = rayhit.hit;
+	if (hit.instID[0] == RTC_INVALID_GEOMETRY_ID) {
+		m_shapeIDs.at(hit.geomID).shape->setHitInformation(ray, rayhit.ray.tfar, hit, its);
+		its.instance = nullptr;
+		return;
+	}
+
+	// the shapes of a group compute the hit in the group's local coordinates,
+	// the ray distance is the same since the direction isn't normalized
+	auto &instance = m_instanceIDs.at(hit.instID[0]);
+	const Transform &toWorld = instance.instance->getTransform();
+	auto shape = instance.group->shapeIDs.at(hit.geomID).shape;
+	shape->setHitInformation(instance.instance->getToLocal() * ray, rayhit.ray.tfar, hit, its);
+
+	its.p = toWorld * its.p;
+	its.shFrame = Frame((toWorld * its.shFrame.n).normalized());
+	its.geoFrame = Frame((toWorld * its.geoFrame.n).normalized());
+	its.instance = &toWorld;
+}
+
+void Scene::activate() {
 	if (!m_integrator)
 		throw NoriException("No integrator was specified!");
 	if (!m_camera)
@@ -94,10 +250,31 @@ void Scene::activate() {
 		  NoriObjectFactory::createInstance("independent", PropertyList()));
 	}
 
-	m_scene = rtcNewScene(EmbreeDevice::instance().device());
-	auto sceneFlags = RTC_SCENE_FLAG_ROBUST;
-	rtcSetSceneFlags(m_scene, sceneFlags);
+	// the meshes have been loading in parallel while the XML file was parsed
+	for (auto shape : m_shapes)
+		shape->waitUntilLoaded();
+	for (auto group : m_groups)
+		group->waitUntilLoaded();
+
+	// the bounds don't depend on the acceleration data structure
+	m_bbox.reset();
+	for (auto shape : m_shapes)
+		m_bbox.expandBy(shape->getBoundingBox());
+
+	if (m_useEmbree && !EmbreeDevice::instance().device()) {
+		cerr << "Warning: Embree is not available, falling back to accel = \"bvh\"" << endl;
+		m_useEmbree = false;
+	}
+
+	cout << "Building the " << (m_useEmbree ? "Embree" : "Nori") << " BVH .. ";
+	cout.flush();
 	build();
+	cout << "done. (took " << timeString(m_buildTime) << " and "
+	     << memString(m_buildMemory) << ")" << endl;
+
+	// the instances are bound to their groups by build()
+	for (auto instance : m_instances)
+		m_bbox.expandBy(instance->getBoundingBox());
 
 	// build pdf for emitters
 	if (m_emitters.size() > 0) {
@@ -113,100 +290,229 @@ void Scene::activate() {
 	cout << endl;
 }
 
+void Scene::setBuildOptions(const std::string &flags, const std::string &quality) {
+	m_sceneFlags = toSceneFlags(flags);
+	m_buildQuality = toBuildQuality(quality);
+	if (m_built)
+		build();
+}
+
+void Scene::setAccel(const std::string &name) {
+	m_useEmbree = toUseEmbree(name);
+	if (m_built)
+		build();
+}
+
 void Scene::build() {
-	for (auto shape : m_shapes) {
-		if (auto mesh = dynamic_cast<Mesh *>(shape)) {
-			auto geom = rtcNewGeometry(EmbreeDevice::instance().device(), RTC_GEOMETRY_TYPE_TRIANGLE);
-			rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0,
-			                           RTC_FORMAT_FLOAT3, mesh->getVertexPositions().data(),
-			                           0, sizeof(Eigen::Vector3f), mesh->getVertexCount());
-			rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0,
-			                           RTC_FORMAT_UINT3, mesh->getIndices().data(),
-			                           0, sizeof(Eigen::Vector3i), mesh->getTriangleCount());
-			rtcCommitGeometry(geom);
-			auto geomID = rtcAttachGeometry(m_scene, geom);
-			m_shapeIDs[geomID] = ShapeData{shape, geomID};
-			rtcReleaseGeometry(geom);
+	release();
+	m_built = true;
+
+	if (!m_useEmbree) {
+		if (!m_groups.empty() || !m_instances.empty())
+			throw NoriException("Shape groups and instances require accel = \"embree\"!");
+		Timer timer;
+		EmbreeDevice::arena().execute([this] { m_accel->build(); });
+		m_buildTime = timer.elapsed();
+		m_buildMemory = m_accel->getMemoryUsage();
+		return;
+	}
+
+	// refitting only applies to the BVHs of the geometries
+	RTCBuildQuality sceneQuality = m_buildQuality == RTC_BUILD_QUALITY_REFIT ?
+	  RTC_BUILD_QUALITY_MEDIUM : m_buildQuality;
+	size_t memory = EmbreeDevice::instance().memoryUsage();
+	Timer timer;
+
+	m_scene = rtcNewScene(EmbreeDevice::instance().device());
+	rtcSetSceneFlags(m_scene, m_sceneFlags);
+	rtcSetSceneBuildQuality(m_scene, sceneQuality);
+
+	// every group is built once into a scene of its own ...
+	for (auto group : m_groups) {
+		if (m_groupData.count(group->getId())) {
+			throw NoriException("There can only be one group with the id \"%s\"!", group->getId());
+		}
+		auto &data = m_groupData[group->getId()];
+		data.scene = rtcNewScene(EmbreeDevice::instance().device());
+		rtcSetSceneFlags(data.scene, m_sceneFlags);
+		rtcSetSceneBuildQuality(data.scene, sceneQuality);
+		for (auto shape : group->getShapes()) {
+			attachShape(data.scene, shape, data.shapeIDs);
 		}
-		else {
-			auto geom = rtcNewGeometry(EmbreeDevice::instance().device(), RTC_GEOMETRY_TYPE_USER);
-			auto geomID = rtcAttachGeometry(m_scene, geom);
-			m_shapeIDs[geomID] = ShapeData{shape, geomID};
-			rtcSetGeometryUserPrimitiveCount(geom, 1);
-			rtcSetGeometryUserData(geom, &(m_shapeIDs.at(geomID)));
-			rtcSetGeometryBoundsFunction(geom,
-			                             [](const RTCBoundsFunctionArguments *args) {
-				                             auto shape = ((ShapeData *)args->geometryUserPtr)->shape;
-				                             auto &aabb = shape->getBoundingBox();
-				                             args->bounds_o->lower_x = aabb.min.x();
-				                             args->bounds_o->lower_y = aabb.min.y();
-				                             args->bounds_o->lower_z = aabb.min.z();
-				                             args->bounds_o->upper_x = aabb.max.x();
-				                             args->bounds_o->upper_y = aabb.max.y();
-				                             args->bounds_o->upper_z = aabb.max.z();
-			                             },
-			                             nullptr);
-			rtcSetGeometryIntersectFunction(geom,
-			                                [](const RTCIntersectFunctionNArguments *args) {
-				                                auto valid = args->valid;
-				                                if (!valid[0]) return;
-
-				                                auto shape = ((ShapeData *)args->geometryUserPtr)->shape;
-				                                auto &rayhit = *(RTCRayHit *)(args->rayhit);
-
-				                                Ray3f ray(Point3f(rayhit.ray.org_x, rayhit.ray.org_y, rayhit.ray.org_z),
-				                                          Vector3f(rayhit.ray.dir_x, rayhit.ray.dir_y, rayhit.ray.dir_z),
-				                                          rayhit.ray.tnear, rayhit.ray.tfar);
+		commitScene(data.scene);
+	}
+
+	// ... and referenced by its instances
+	for (auto instance : m_instances) {
+		auto group = std::find_if(m_groups.begin(), m_groups.end(), [&](const ShapeGroup *g) {
+			return g->getId() == instance->getGroupId();
+		});
+		if (group == m_groups.end()) {
+			throw NoriException("There is no group with the id \"%s\"!", instance->getGroupId());
+		}
+		instance->setGroup(*group);
+		auto &data = m_groupData.at(instance->getGroupId());
+
+		auto geom = rtcNewGeometry(EmbreeDevice::instance().device(), RTC_GEOMETRY_TYPE_INSTANCE);
+		rtcSetGeometryInstancedScene(geom, data.scene);
+		rtcSetGeometryTransform(geom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
+		                        instance->getTransform().getMatrix().data());
+		rtcSetGeometryBuildQuality(geom, m_buildQuality);
+		rtcCommitGeometry(geom);
+		auto geomID = rtcAttachGeometry(m_scene, geom);
+		m_instanceIDs[geomID] = InstanceData{instance, &data};
+		rtcReleaseGeometry(geom);
+	}
+
+	for (auto shape : m_shapes) {
+		attachShape(m_scene, shape, m_shapeIDs);
+	}
+
+	commitScene(m_scene);
+
+	m_buildTime = timer.elapsed();
+	size_t used = EmbreeDevice::instance().memoryUsage();
+	m_buildMemory = used > memory ? used - memory : 0;
+}
+
+void Scene::release() {
+	m_accel->clear();
+	if (m_scene) {
+		rtcReleaseScene(m_scene);
+		m_scene = nullptr;
+	}
+	for (auto &group : m_groupData) {
+		rtcReleaseScene(group.second.scene);
+	}
+	m_groupData.clear();
+	m_instanceIDs.clear();
+	m_shapeIDs.clear();
+}
+
+void Scene::attachShape(RTCScene scene, Shape *shape,
+                        std::unordered_map<uint32_t, ShapeData> &shapeIDs) {
+	if (auto mesh = dynamic_cast<Mesh *>(shape)) {
+		auto geom = rtcNewGeometry(EmbreeDevice::instance().device(), RTC_GEOMETRY_TYPE_TRIANGLE);
+		rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0,
+		                           RTC_FORMAT_FLOAT3, mesh->getVertexPositions().data(),
+		                           0, sizeof(Eigen::Vector3f), mesh->getVertexCount());
+		rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0,
+		                           RTC_FORMAT_UINT3, mesh->getIndices().data(),
+		                           0, sizeof(Eigen::Vector3i), mesh->getTriangleCount());
+		rtcSetGeometryBuildQuality(geom, m_buildQuality);
+		rtcCommitGeometry(geom);
+		auto geomID = rtcAttachGeometry(scene, geom);
+		shapeIDs[geomID] = ShapeData{shape, geomID};
+		rtcReleaseGeometry(geom);
+	}
+	else if (auto spheres = dynamic_cast<SphereSet *>(shape)) {
+		auto geom = spheres->createGeometry(EmbreeDevice::instance().device());
+		rtcSetGeometryBuildQuality(geom, m_buildQuality);
+		rtcCommitGeometry(geom);
+		auto geomID = rtcAttachGeometry(scene, geom);
+		shapeIDs[geomID] = ShapeData{shape, geomID};
+		rtcReleaseGeometry(geom);
+	}
+	else {
+		auto geom = rtcNewGeometry(EmbreeDevice::instance().device(), RTC_GEOMETRY_TYPE_USER);
+		auto geomID = rtcAttachGeometry(scene, geom);
+		shapeIDs[geomID] = ShapeData{shape, geomID};
+		rtcSetGeometryUserPrimitiveCount(geom, 1);
+		rtcSetGeometryBuildQuality(geom, m_buildQuality);
+		rtcSetGeometryUserData(geom, &(shapeIDs.at(geomID)));
+		rtcSetGeometryBoundsFunction(geom,
+		                             [](const RTCBoundsFunctionArguments *args) {
+			                             auto shape = ((ShapeData *)args->geometryUserPtr)->shape;
+			                             auto &aabb = shape->getBoundingBox();
+			                             args->bounds_o->lower_x = aabb.min.x();
+			                             args->bounds_o->lower_y = aabb.min.y();
+			                             args->bounds_o->lower_z = aabb.min.z();
+			                             args->bounds_o->upper_x = aabb.max.x();
+			                             args->bounds_o->upper_y = aabb.max.y();
+			                             args->bounds_o->upper_z = aabb.max.z();
+		                             },
+		                             nullptr);
+		/* Packets and streams of rays (see rayIntersect() for coherent
+		   rays) are handed to the callbacks as N rays at once */
+		rtcSetGeometryIntersectFunction(geom,
+		                                [](const RTCIntersectFunctionNArguments *args) {
+			                                auto shape = ((ShapeData *)args->geometryUserPtr)->shape;
+			                                RTCRayN *rays = RTCRayHitN_RayN(args->rayhit, args->N);
+			                                RTCHitN *hits = RTCRayHitN_HitN(args->rayhit, args->N);
+
+			                                for (unsigned int i = 0; i < args->N; ++i) {
+				                                if (!args->valid[i])
+					                                continue;
+
+				                                Ray3f ray(Point3f(RTCRayN_org_x(rays, args->N, i),
+				                                                  RTCRayN_org_y(rays, args->N, i),
+				                                                  RTCRayN_org_z(rays, args->N, i)),
+				                                          Vector3f(RTCRayN_dir_x(rays, args->N, i),
+				                                                   RTCRayN_dir_y(rays, args->N, i),
+				                                                   RTCRayN_dir_z(rays, args->N, i)),
+				                                          RTCRayN_tnear(rays, args->N, i), RTCRayN_tfar(rays, args->N, i));
 
 				                                float t;
 				                                Normal3f normal;
 				                                Vector2f uv;
 				                                if (shape->rayIntersect(ray, t, normal, uv)) {
-					                                rayhit.ray.tfar = t;
-
-					                                rayhit.hit.u = uv.x();
-					                                rayhit.hit.v = uv.y();
-					                                rayhit.hit.Ng_x = normal.x();
-					                                rayhit.hit.Ng_y = normal.y();
-					                                rayhit.hit.Ng_z = normal.z();
-					                                rayhit.hit.instID[0] = args->context->instID[0];
-					                                rayhit.hit.geomID = ((ShapeData *)args->geometryUserPtr)->geomID;
-					                                rayhit.hit.primID = args->primID;
+					                                RTCRayN_tfar(rays, args->N, i) = t;
+
+					                                RTCHitN_u(hits, args->N, i) = uv.x();
+					                                RTCHitN_v(hits, args->N, i) = uv.y();
+					                                RTCHitN_Ng_x(hits, args->N, i) = normal.x();
+					                                RTCHitN_Ng_y(hits, args->N, i) = normal.y();
+					                                RTCHitN_Ng_z(hits, args->N, i) = normal.z();
+					                                RTCHitN_instID(hits, args->N, i, 0) = args->context->instID[0];
+					                                RTCHitN_geomID(hits, args->N, i) = ((ShapeData *)args->geometryUserPtr)->geomID;
+					                                RTCHitN_primID(hits, args->N, i) = args->primID;
 				                                }
-			                                });
-			rtcSetGeometryOccludedFunction(geom,
-			                               [](const RTCOccludedFunctionNArguments *args) {
-				                               auto valid = args->valid;
-				                               if (!valid[0]) return;
-
-				                               auto shape = ((ShapeData *)args->geometryUserPtr)->shape;
-				                               auto &rtcRay = *(RTCRay *)(args->ray);
-
-				                               Ray3f ray(Point3f(rtcRay.org_x, rtcRay.org_y, rtcRay.org_z),
-				                                         Vector3f(rtcRay.dir_x, rtcRay.dir_y, rtcRay.dir_z),
-				                                         rtcRay.tnear, rtcRay.tfar);
+			                                }
+		                                });
+		rtcSetGeometryOccludedFunction(geom,
+		                               [](const RTCOccludedFunctionNArguments *args) {
+			                               auto shape = ((ShapeData *)args->geometryUserPtr)->shape;
+			                               RTCRayN *rays = args->ray;
+
+			                               for (unsigned int i = 0; i < args->N; ++i) {
+				                               if (!args->valid[i])
+					                               continue;
+
+				                               Ray3f ray(Point3f(RTCRayN_org_x(rays, args->N, i),
+				                                                 RTCRayN_org_y(rays, args->N, i),
+				                                                 RTCRayN_org_z(rays, args->N, i)),
+				                                         Vector3f(RTCRayN_dir_x(rays, args->N, i),
+				                                                  RTCRayN_dir_y(rays, args->N, i),
+				                                                  RTCRayN_dir_z(rays, args->N, i)),
+				                                         RTCRayN_tnear(rays, args->N, i), RTCRayN_tfar(rays, args->N, i));
 
 				                               float t;
 				                               Normal3f normal;
 				                               Vector2f uv;
 				                               if (shape->rayIntersect(ray, t, normal, uv)) {
-					                               rtcRay.tfar = -std::numeric_limits<float>::infinity();
+					                               RTCRayN_tfar(rays, args->N, i) = -std::numeric_limits<float>::infinity();
 				                               }
-			                               });
-			rtcCommitGeometry(geom);
-			rtcReleaseGeometry(geom);
-		}
+			                               }
+		                               });
+		rtcCommitGeometry(geom);
+		rtcReleaseGeometry(geom);
 	}
-
-	rtcCommitScene(m_scene);
 }
 
 void Scene::addChild(const std::string &name, NoriObject *obj) {
 	switch (obj->getClassType()) {
 	case EShape: {
 		auto shape = static_cast<Shape *>(obj);
-		//m_accel->addMesh(mesh);
+		if (auto group = dynamic_cast<ShapeGroup *>(shape)) {
+			m_groups.push_back(group);
+			break;
+		}
+		if (auto instance = dynamic_cast<Instance *>(shape)) {
+			m_instances.push_back(instance);
+			break;
+		}
 		m_shapes.push_back(shape);
+		m_accel->addShape(shape);
 		if (shape->isEmitter()) {
 			m_emitters.push_back(shape->getEmitter());
 		}
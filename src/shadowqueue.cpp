@@ -0,0 +1,44 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/shadowqueue.h>
+#include <nori/scene.h>
+
+NORI_NAMESPACE_BEGIN
+
+void ShadowQueue::resolve(const Scene *scene, Color3f *radiance) {
+    if (m_rays.empty())
+        return;
+
+    if (m_capacity < m_rays.size()) {
+        m_capacity = std::max(m_rays.size(), 2 * m_capacity);
+        m_occluded.reset(new bool[m_capacity]);
+    }
+
+    scene->rayOccluded(m_rays.data(), m_occluded.get(), m_rays.size());
+    for (size_t i = 0; i < m_rays.size(); ++i) {
+        if (!m_occluded[i])
+            radiance[m_samples[i]] += m_values[i];
+    }
+
+    m_rays.clear();
+    m_samples.clear();
+    m_values.clear();
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,126 @@
+#include <nori/instance.h>
+#include <nori/bsdf.h>
+
+NORI_NAMESPACE_BEGIN
+
+ShapeGroup::ShapeGroup(const PropertyList& props) :
+    Shape(props) {
+	m_id = props.getString("id");
+}
+
+ShapeGroup::~ShapeGroup() {
+	for (auto shape : m_shapes) delete shape;
+}
+
+float ShapeGroup::area() const {
+	float area = 0.0f;
+	for (auto shape : m_shapes)
+		area += shape->area();
+	return area;
+}
+
+void ShapeGroup::addChild(const std::string& name, NoriObject* child) {
+	if (child->getClassType() != EShape) {
+		throw NoriException("ShapeGroup::addChild(<%s>) is not supported!",
+		                    classTypeName(child->getClassType()));
+	}
+
+	auto shape = static_cast<Shape*>(child);
+	if (dynamic_cast<ShapeGroup*>(shape) || dynamic_cast<Instance*>(shape)) {
+		throw NoriException("ShapeGroup \"%s\": groups can't be nested!", m_id);
+	}
+	if (shape->isEmitter()) {
+		throw NoriException("ShapeGroup \"%s\": the shapes of a group can't be emitters!", m_id);
+	}
+	m_shapes.push_back(shape);
+}
+
+void ShapeGroup::activate() {
+	// unlike other shapes, the group has no material of its own
+	if (m_shapes.empty()) {
+		throw NoriException("ShapeGroup \"%s\" is empty!", m_id);
+	}
+}
+
+void ShapeGroup::waitUntilLoaded() {
+	// the shapes may still be loading when the group is activated
+	m_bbox.reset();
+	for (auto shape : m_shapes) {
+		shape->waitUntilLoaded();
+		m_bbox.expandBy(shape->getBoundingBox());
+	}
+}
+
+ShapeSamplingResult ShapeGroup::sample(const Point2f& sample) const {
+	throw NoriException("ShapeGroup::sample(): groups can't be sampled!");
+}
+
+ShapeSamplingResult ShapeGroup::sample(const Intersection& ref, const Point2f& sample) const {
+	throw NoriException("ShapeGroup::sample(): groups can't be sampled!");
+}
+
+std::string ShapeGroup::toString() const {
+	std::string shapes;
+	for (size_t i = 0; i < m_shapes.size(); ++i) {
+		shapes += std::string("  ") + indent(m_shapes[i]->toString(), 2);
+		if (i + 1 < m_shapes.size())
+			shapes += ",";
+		shapes += "\n";
+	}
+
+	return tfm::format(
+	  "ShapeGroup[\n"
+	  "  id = \"%s\",\n"
+	  "  shapes = {\n"
+	  "  %s  }\n"
+	  "]",
+	  m_id,
+	  indent(shapes, 2));
+}
+
+Instance::Instance(const PropertyList& props) :
+    Shape(props) {
+	m_groupId = props.getString("group");
+	m_toLocal = m_transform.inverse();
+}
+
+void Instance::setGroup(const ShapeGroup* group) {
+	m_group = group;
+
+	// transform the corners of the group's bounding box
+	const BoundingBox3f& bbox = group->getBoundingBox();
+	m_bbox.reset();
+	for (int i = 0; i < 8; ++i)
+		m_bbox.expandBy(m_transform * bbox.getCorner(i));
+}
+
+float Instance::area() const {
+	// only exact for rigid transforms
+	return m_group ? m_group->area() : 0.0f;
+}
+
+void Instance::activate() {
+	// the instanced shapes have their own materials
+}
+
+ShapeSamplingResult Instance::sample(const Point2f& sample) const {
+	throw NoriException("Instance::sample(): instances can't be sampled!");
+}
+
+ShapeSamplingResult Instance::sample(const Intersection& ref, const Point2f& sample) const {
+	throw NoriException("Instance::sample(): instances can't be sampled!");
+}
+
+std::string Instance::toString() const {
+	return tfm::format(
+	  "Instance[\n"
+	  "  group = \"%s\",\n"
+	  "  toWorld = %s\n"
+	  "]",
+	  m_groupId,
+	  indent(m_transform.toString()));
+}
+
+NORI_REGISTER_CLASS(ShapeGroup, "group");
+NORI_REGISTER_CLASS(Instance, "instance");
+NORI_NAMESPACE_END
@@ -15,6 +15,7 @@ public:
 	    Shape(props) {
 		m_radius = props.getFloat("radius", 1.0f);
 
+		m_toLocal = m_transform.inverse();
 		m_center = (m_transform.getMatrix().col(3)).head<3>();
 		m_bbox.min = m_center + Vector3f(-m_radius);
 		m_bbox.max = m_center + Vector3f(m_radius);
@@ -27,7 +28,7 @@ public:
 	bool rayIntersect(const Ray3f& ray, float& t,
 	                  Normal3f& normal, Vector2f& uv) const override {
 		// transform ray to object space
-		Ray3f localRay = m_transform.inverse() * ray;
+		Ray3f localRay = m_toLocal * ray;
 
 		// compute quadratic sphere coefficients
 		float a = localRay.d.x() * localRay.d.x() + localRay.d.y() * localRay.d.y() +
@@ -69,7 +70,7 @@ public:
 		its.p = m_center + hitdir * m_radius;
 
 		// find parametric representation of sphere hit
-		auto localHit = m_transform.inverse() * Vector3f(its.p - m_center);
+		auto localHit = m_toLocal * Vector3f(its.p - m_center);
 		if (localHit.x() == 0 && localHit.y() == 0) {
 			localHit.x() = 1e-5f * m_radius;
 		}
@@ -180,6 +181,7 @@ public:
 private:
 	float m_radius;
 	Point3f m_center;
+	Transform m_toLocal;  ///< Inverse of m_transform
 };
 
 NORI_REGISTER_CLASS(Sphere, "sphere");
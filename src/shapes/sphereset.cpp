@@ -0,0 +1,276 @@
+#include <nori/sphereset.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/warp.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <fstream>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+SphereSet::SphereSet(const PropertyList& props) :
+    Shape(props) {
+	Timer timer;
+	std::string filename = props.getString("filename", "");
+	if (!filename.empty()) {
+		filesystem::path path = getFileResolver()->resolve(filename);
+		loadBinary(path.str());
+		m_name = path.str();
+	}
+	else {
+		loadList(props);
+	}
+	if (m_spheres.cols() == 0) {
+		throw NoriException("SphereSet: no spheres were specified!");
+	}
+
+	// move the centers, compute the bounding box and the sampling table
+	m_areaPDF.reserve(m_spheres.cols());
+	for (int i = 0; i < m_spheres.cols(); ++i) {
+		Point3f center = m_transform * Point3f(m_spheres.col(i).head<3>());
+		float radius = m_spheres(3, i);
+		if (radius <= 0) {
+			throw NoriException("SphereSet: the radius of sphere %i isn't positive!", i);
+		}
+		m_spheres.col(i).head<3>() = center;
+
+		m_bbox.expandBy(center - Vector3f(radius));
+		m_bbox.expandBy(center + Vector3f(radius));
+		m_areaPDF.append(4 * M_PI * radius * radius);
+	}
+	m_area = m_areaPDF.normalize();
+
+	// a single write, since meshes may finish loading in the background
+	if (!filename.empty()) {
+		cout << tfm::format("Loaded \"%s\" (N=%i, took %s and %s)\n", m_name,
+		                    m_spheres.cols(), timer.elapsedString(),
+		                    memString(m_spheres.size() * sizeof(float)))
+		     << std::flush;
+	}
+}
+
+void SphereSet::loadBinary(const std::string& filename) {
+	std::ifstream is(filename, std::ios::binary);
+	if (is.fail())
+		throw NoriException("Unable to open sphere file \"%s\"!", filename);
+
+	uint32_t count = 0;
+	is.read((char*)&count, sizeof(uint32_t));
+	m_spheres.resize(4, count);
+	is.read((char*)m_spheres.data(), sizeof(float) * m_spheres.size());
+	if (is.fail())
+		throw NoriException("Sphere file \"%s\" is truncated!", filename);
+}
+
+void SphereSet::loadList(const PropertyList& props) {
+	std::vector<std::string> centers = tokenize(props.getString("centers", ""));
+	std::vector<std::string> radii = tokenize(props.getString("radii", ""));
+
+	// long lists tend to end with a delimiter, which results in an empty token
+	auto isEmpty = [](const std::string& token) { return token.empty(); };
+	centers.erase(std::remove_if(centers.begin(), centers.end(), isEmpty), centers.end());
+	radii.erase(std::remove_if(radii.begin(), radii.end(), isEmpty), radii.end());
+	if (centers.size() % 3 != 0) {
+		throw NoriException("SphereSet: expected x y z triples in 'centers'!");
+	}
+	size_t count = centers.size() / 3;
+	if (!radii.empty() && radii.size() != count) {
+		throw NoriException("SphereSet: got %i centers but %i radii!", count, radii.size());
+	}
+	float radius = props.getFloat("radius", 1.0f);
+
+	m_spheres.resize(4, count);
+	for (size_t i = 0; i < count; ++i) {
+		m_spheres(0, i) = toFloat(centers[3 * i]);
+		m_spheres(1, i) = toFloat(centers[3 * i + 1]);
+		m_spheres(2, i) = toFloat(centers[3 * i + 2]);
+		m_spheres(3, i) = radii.empty() ? radius : toFloat(radii[i]);
+	}
+}
+
+/// Intersect a ray (o, d) with the given sphere in [tnear, tfar]
+static inline bool intersectSphere(const float* sphere, float ox, float oy, float oz,
+                                   float dx, float dy, float dz, float tnear, float tfar,
+                                   float& t) {
+	float cx = ox - sphere[0], cy = oy - sphere[1], cz = oz - sphere[2];
+
+	// compute quadratic sphere coefficients
+	float a = dx * dx + dy * dy + dz * dz;
+	float b = 2 * (dx * cx + dy * cy + dz * cz);
+	float c = cx * cx + cy * cy + cz * cz - sphere[3] * sphere[3];
+
+	float t0, t1;
+	if (!solveQuadratic(a, b, c, t0, t1)) {
+		return false;
+	}
+	if (t0 > tfar || t1 < tnear) {
+		return false;
+	}
+	if (t0 < tnear) {
+		if (tfar < t1) return false;
+		t = t1;
+	}
+	else {
+		t = t0;
+	}
+	return true;
+}
+
+bool SphereSet::rayIntersect(uint32_t index, const Ray3f& ray, float& t) const {
+	return intersectSphere(m_spheres.col(index).data(), ray.o.x(), ray.o.y(), ray.o.z(),
+	                       ray.d.x(), ray.d.y(), ray.d.z(), ray.mint, ray.maxt, t);
+}
+
+RTCGeometry SphereSet::createGeometry(RTCDevice device) const {
+#if RTC_VERSION >= 30600
+	if (rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_POINT_GEOMETRY_SUPPORTED)) {
+		auto geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_SPHERE_POINT);
+		rtcSetSharedGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0,
+		                           RTC_FORMAT_FLOAT4, m_spheres.data(),
+		                           0, 4 * sizeof(float), getSphereCount());
+		return geom;
+	}
+#endif
+
+	// without native spheres, every sphere is a primitive of a user geometry
+	auto geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+	rtcSetGeometryUserPrimitiveCount(geom, getSphereCount());
+	rtcSetGeometryUserData(geom, (void*)this);
+	rtcSetGeometryBoundsFunction(geom,
+	                             [](const RTCBoundsFunctionArguments* args) {
+		                             auto spheres = (const SphereSet*)args->geometryUserPtr;
+		                             const float* sphere = spheres->m_spheres.col(args->primID).data();
+		                             args->bounds_o->lower_x = sphere[0] - sphere[3];
+		                             args->bounds_o->lower_y = sphere[1] - sphere[3];
+		                             args->bounds_o->lower_z = sphere[2] - sphere[3];
+		                             args->bounds_o->upper_x = sphere[0] + sphere[3];
+		                             args->bounds_o->upper_y = sphere[1] + sphere[3];
+		                             args->bounds_o->upper_z = sphere[2] + sphere[3];
+	                             },
+	                             nullptr);
+	// the rays are accessed in place, without creating a Ray3f
+	rtcSetGeometryIntersectFunction(geom,
+	                                [](const RTCIntersectFunctionNArguments* args) {
+		                                auto spheres = (const SphereSet*)args->geometryUserPtr;
+		                                const float* sphere = spheres->m_spheres.col(args->primID).data();
+		                                RTCRayN* rays = RTCRayHitN_RayN(args->rayhit, args->N);
+		                                RTCHitN* hits = RTCRayHitN_HitN(args->rayhit, args->N);
+		                                unsigned int N = args->N;
+
+		                                for (unsigned int i = 0; i < N; ++i) {
+			                                if (!args->valid[i])
+				                                continue;
+
+			                                float t;
+			                                if (!intersectSphere(sphere,
+			                                                     RTCRayN_org_x(rays, N, i), RTCRayN_org_y(rays, N, i),
+			                                                     RTCRayN_org_z(rays, N, i), RTCRayN_dir_x(rays, N, i),
+			                                                     RTCRayN_dir_y(rays, N, i), RTCRayN_dir_z(rays, N, i),
+			                                                     RTCRayN_tnear(rays, N, i), RTCRayN_tfar(rays, N, i), t))
+				                                continue;
+
+			                                RTCRayN_tfar(rays, N, i) = t;
+			                                RTCHitN_u(hits, N, i) = 0.0f;
+			                                RTCHitN_v(hits, N, i) = 0.0f;
+			                                RTCHitN_Ng_x(hits, N, i) = RTCRayN_org_x(rays, N, i) + t * RTCRayN_dir_x(rays, N, i) - sphere[0];
+			                                RTCHitN_Ng_y(hits, N, i) = RTCRayN_org_y(rays, N, i) + t * RTCRayN_dir_y(rays, N, i) - sphere[1];
+			                                RTCHitN_Ng_z(hits, N, i) = RTCRayN_org_z(rays, N, i) + t * RTCRayN_dir_z(rays, N, i) - sphere[2];
+			                                RTCHitN_instID(hits, N, i, 0) = args->context->instID[0];
+			                                RTCHitN_geomID(hits, N, i) = args->geomID;
+			                                RTCHitN_primID(hits, N, i) = args->primID;
+		                                }
+	                                });
+	rtcSetGeometryOccludedFunction(geom,
+	                               [](const RTCOccludedFunctionNArguments* args) {
+		                               auto spheres = (const SphereSet*)args->geometryUserPtr;
+		                               const float* sphere = spheres->m_spheres.col(args->primID).data();
+		                               RTCRayN* rays = args->ray;
+		                               unsigned int N = args->N;
+
+		                               for (unsigned int i = 0; i < N; ++i) {
+			                               if (!args->valid[i])
+				                               continue;
+
+			                               float t;
+			                               if (intersectSphere(sphere,
+			                                                   RTCRayN_org_x(rays, N, i), RTCRayN_org_y(rays, N, i),
+			                                                   RTCRayN_org_z(rays, N, i), RTCRayN_dir_x(rays, N, i),
+			                                                   RTCRayN_dir_y(rays, N, i), RTCRayN_dir_z(rays, N, i),
+			                                                   RTCRayN_tnear(rays, N, i), RTCRayN_tfar(rays, N, i), t)) {
+				                               RTCRayN_tfar(rays, N, i) = -std::numeric_limits<float>::infinity();
+			                               }
+		                               }
+	                               });
+	return geom;
+}
+
+void SphereSet::setHitInformation(const Ray3f& ray, const float& t, const RTCHit& hit,
+                                  Intersection& its) const {
+	Point3f center = m_spheres.col(hit.primID).head<3>();
+	float radius = m_spheres(3, hit.primID);
+
+	its.t = t;
+	its.p = ray(t);
+
+	Vector3f hitdir = (its.p - center).normalized();
+
+	// refine to be closer to the surface
+	its.p = center + hitdir * radius;
+
+	// find parametric representation of sphere hit
+	auto localHit = hitdir;
+	if (localHit.x() == 0 && localHit.y() == 0) {
+		localHit.x() = 1e-5f;
+	}
+	auto phi = std::atan2(localHit.y(), localHit.x());
+	if (phi < 0) phi += 2 * M_PI;
+	auto theta = std::acos(clamp(localHit.z(), -1.0f, 1.0f));
+	its.uv.x() = phi * 0.5f * INV_PI;
+	its.uv.y() = theta * INV_PI;
+
+	its.geoFrame = Frame(hitdir);
+	its.shFrame = its.geoFrame;
+	its.shape = this;
+}
+
+ShapeSamplingResult SphereSet::sample(const Point2f& sample) const {
+	ShapeSamplingResult result;
+
+	// choose a sphere according to its area
+	Point2f _sample(sample);
+	auto index = m_areaPDF.sampleReuse(_sample.y());
+
+	Vector3f v = Warp::squareToUniformSphere(_sample);
+	result.p = Point3f(m_spheres.col(index).head<3>()) + m_spheres(3, index) * v;
+	result.n = Normal3f(v);
+	result.measure = EMeasure::EArea;
+
+	return result;
+}
+
+ShapeSamplingResult SphereSet::sample(const Intersection& ref, const Point2f& sample) const {
+	// just fallback to sample with area
+	auto areaSample = this->sample(sample);
+	areaSample.measure = EMeasure::ESolidAngle;
+	return areaSample;
+}
+
+std::string SphereSet::toString() const {
+	return tfm::format(
+	  "SphereSet[\n"
+	  "  name = \"%s\",\n"
+	  "  sphereCount = %i,\n"
+	  "  aabb = %s,\n"
+	  "  bsdf = %s,\n"
+	  "  emitter = %s\n"
+	  "]",
+	  m_name,
+	  m_spheres.cols(),
+	  indent(m_bbox.toString()),
+	  m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+	  m_emitter ? indent(m_emitter->toString()) : std::string("null"));
+}
+
+NORI_REGISTER_CLASS(SphereSet, "spheres");
+NORI_NAMESPACE_END
@@ -0,0 +1,191 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/wavefront.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/block.h>
+#include <nori/bbox.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Spread the lower 9 bits of a value to every third bit
+static uint32_t spreadBits(uint32_t x) {
+    x &= 0x1ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x <<  8)) & 0x0300f00f;
+    x = (x | (x <<  4)) & 0x030c30c3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+Wavefront::Wavefront()
+    : m_its(NORI_WAVEFRONT_SIZE), m_found(new bool[NORI_WAVEFRONT_SIZE]) {
+    m_pixelSamples.reserve(NORI_WAVEFRONT_SIZE);
+    m_weights.reserve(NORI_WAVEFRONT_SIZE);
+    m_radiance.reserve(NORI_WAVEFRONT_SIZE);
+    m_throughput.resize(NORI_WAVEFRONT_SIZE);
+    m_pdf.resize(NORI_WAVEFRONT_SIZE);
+    m_vertex.resize(NORI_WAVEFRONT_SIZE);
+    m_rays.reserve(NORI_WAVEFRONT_SIZE);
+    m_paths.reserve(NORI_WAVEFRONT_SIZE);
+    m_hitRays.reserve(NORI_WAVEFRONT_SIZE);
+    m_hitPaths.reserve(NORI_WAVEFRONT_SIZE);
+}
+
+void Wavefront::addPath(const Point2f &pixelSample, const Ray3f &ray, const Color3f &weight) {
+    m_rays.push_back(ray);
+    m_paths.push_back((uint32_t) m_pixelSamples.size());
+    m_pixelSamples.push_back(pixelSample);
+    m_weights.push_back(weight);
+    m_radiance.push_back(Color3f(0.0f));
+}
+
+void Wavefront::render(const Scene *scene, Sampler *sampler, ImageBlock &block) {
+    const Integrator *integrator = scene->getIntegrator();
+
+    for (m_depth = 0; !m_rays.empty(); ++m_depth) {
+        /* Trace the queued rays (only the camera rays are coherent) */
+        m_hitRays.swap(m_rays);
+        m_hitPaths.swap(m_paths);
+        m_rays.clear();
+        m_paths.clear();
+        if (m_hitRays.size() > m_its.size()) {
+            /* An integrator extended some paths more than once */
+            m_its.resize(m_hitRays.size());
+            m_found.reset(new bool[m_hitRays.size()]);
+        }
+        if (m_sortBatch > 0 && m_depth > 0)
+            sortRays(m_hitRays, m_hitPaths, nullptr);
+        scene->rayIntersect(m_hitRays.data(), m_its.data(), m_found.get(),
+                            m_hitRays.size(), m_depth == 0);
+
+        /* Shade the hits, which queues extension and shadow rays */
+        if (m_sortBatch > 0)
+            sortHits();
+        integrator->shade(scene, sampler, *this);
+
+        /* Trace the shadow rays, and add the radiance of the unoccluded ones */
+        if (m_sortBatch > 0)
+            sortRays(m_shadows.m_rays, m_shadows.m_samples, &m_shadows.m_values);
+        m_shadows.resolve(scene, m_radiance.data());
+    }
+
+    /* Store the radiance of all paths in the image block */
+    for (size_t i = 0; i < m_pixelSamples.size(); ++i)
+        block.put(m_pixelSamples[i], m_weights[i] * m_radiance[i]);
+
+    m_pixelSamples.clear();
+    m_weights.clear();
+    m_radiance.clear();
+    m_hitRays.clear();
+    m_hitPaths.clear();
+    m_depth = 0;
+}
+
+void Wavefront::sortRays(std::vector<Ray3f> &rays, std::vector<uint32_t> &paths,
+                         std::vector<Color3f> *values) {
+    for (size_t start = 0; start < rays.size(); start += m_sortBatch) {
+        size_t count = std::min(rays.size() - start, m_sortBatch);
+        const Ray3f *window = rays.data() + start;
+
+        BoundingBox3f bounds;
+        for (size_t i = 0; i < count; ++i)
+            bounds.expandBy(window[i].o);
+        Vector3f extents = bounds.getExtents();
+        Vector3f scale;
+        for (int j = 0; j < 3; ++j)
+            scale[j] = extents[j] > 0 ? 511.0f / extents[j] : 0.0f;
+
+        /* Direction octant, followed by the Morton code of the origin cell */
+        m_keys.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            const Ray3f &ray = window[i];
+            Vector3f cell = (ray.o - bounds.min).cwiseProduct(scale);
+            uint32_t key = (ray.d.x() < 0 ? 4u : 0u) | (ray.d.y() < 0 ? 2u : 0u) | (ray.d.z() < 0 ? 1u : 0u);
+            key = (key << 27) | (spreadBits((uint32_t) cell.x()) << 2) |
+                  (spreadBits((uint32_t) cell.y()) << 1) | spreadBits((uint32_t) cell.z());
+            m_keys[i] = ((uint64_t) key << 32) | i;
+        }
+
+        std::sort(m_keys.begin(), m_keys.end());
+        permute(rays.data() + start);
+        permute(paths.data() + start);
+        if (values)
+            permute(values->data() + start);
+    }
+}
+
+void Wavefront::sortHits() {
+    /* Number the BSDFs and shapes in the order in which they are
+       encountered, so that the order of the hits is deterministic */
+    auto rank = [this](const void *ptr) {
+        auto it = m_ranks.find(ptr);
+        if (it == m_ranks.end())
+            it = m_ranks.insert(std::make_pair(ptr, (uint32_t) m_ranks.size())).first;
+        return std::min(it->second, 0x7fffu);
+    };
+
+    size_t hitCount = m_hitRays.size();
+    for (size_t start = 0; start < hitCount; start += m_sortBatch) {
+        size_t count = std::min(hitCount - start, m_sortBatch);
+
+        /* Misses come first */
+        m_ranks.clear();
+        m_keys.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t key = 0;
+            if (m_found[start + i]) {
+                const Shape *shape = m_its[start + i].shape;
+                key = (1u << 31) | (rank(shape->getBSDF()) << 16) | rank(shape);
+            }
+            m_keys[i] = (key << 32) | i;
+        }
+
+        std::sort(m_keys.begin(), m_keys.end());
+        permute(m_hitRays.data() + start);
+        permute(m_hitPaths.data() + start);
+        permute(m_its.data() + start);
+        permute(m_found.get() + start);
+    }
+}
+
+template <typename T> void Wavefront::permute(T *values) {
+    /* The lower 32 bits of the i-th key hold the index of the element
+       that moves to position i. Follow the cycles of this permutation,
+       so that every element is moved only once */
+    m_done.assign(m_keys.size(), 0);
+    for (size_t i = 0; i < m_keys.size(); ++i) {
+        if (m_done[i])
+            continue;
+        T value = values[i];
+        size_t j = i;
+        while (true) {
+            m_done[j] = 1;
+            size_t k = (size_t) (m_keys[j] & 0xffffffffu);
+            if (k == i) {
+                values[j] = value;
+                break;
+            }
+            values[j] = values[k];
+            j = k;
+        }
+    }
+}
+
+NORI_NAMESPACE_END